@@ -20,6 +20,9 @@ public:
     // Check if the box contains an object
     bool contains(const Object &p) const;
 
+    // Check if the box contains a position
+    bool contains(const sf::Vector2f &pos) const;
+
     // Check if two boxes intersect
     bool intersect(const Box &other) const;
 
@@ -38,13 +41,7 @@ private:
     sf::Vector2f half_dimension;
     Boundary boundary;
 
-    // Graphic params
-    sf::VertexArray vertices;
-
-    // Draw box
-    virtual void draw(sf::RenderTarget &target, sf::RenderStates states) const
-    {
-        target.draw(vertices, states);
-    }
+    // Draw box, vertices are built here so that creating a query Box does not allocate
+    virtual void draw(sf::RenderTarget &target, sf::RenderStates states) const;
 };
 
@@ -12,6 +12,33 @@ struct Params
     unsigned nb_particles;
 };
 
+// How particle interactions are resolved in parallel
+// Every mode applies the pressure and collision of a pair from each of its two particles, so they
+// solve the same equations and only differ in the order updates are applied, Critical also moves
+// each particle as soon as its own interactions are done
+enum class SolverMode
+{
+    // Every interaction inside one global omp critical section
+    Critical,
+    // Cells split in 3x3 independent color classes, processed without locks
+    Coloring,
+    // Particles read the previous positions and write only their own next position
+    Jacobi,
+    // Every pair visited once, cells against themselves and their 4 forward neighbors, in 3x2 color classes
+    HalfNeighbor
+};
+
+// Structure used to find neighbor particles
+enum class SpatialIndex
+{
+    // Recursive QuadTree, one insert per particle
+    QuadTree,
+    // Pointerless QuadTree built from sorted Morton codes
+    LinearQuadTree,
+    // Unbounded hash grid, only occupied cells are stored
+    HashGrid
+};
+
 namespace conf
 {
     // Window config
@@ -25,7 +52,10 @@ namespace conf
     // Particle config
     constexpr unsigned NB_PARTICLES = 2000;
     constexpr unsigned TOTAL_VERTICES = 6 * NB_PARTICLES;
+    // Particle vertices are streamed to a GPU vertex buffer, or drawn from memory if it is not supported
+    constexpr bool USE_VERTEX_BUFFER = true;
     constexpr char PARTICLE_TEXTURE_PATH[] = "resources/images/circle.png";
+    // Initial velocities, distances per DT
     constexpr float VMIN = -0.5f;
     constexpr float VMAX = 0.5f;
     constexpr float RADIUS_MIN = 1.0f;
@@ -41,6 +71,56 @@ namespace conf
     constexpr float PARTICLE_DAMPING = 0.3f;
     constexpr unsigned SUBSTEPS = 8;
 
+    // Steps of DT are run as wall-clock time requires, at most MAX_STEPS_PER_FRAME per rendered frame
+    // Time beyond the cap is dropped, so a slow frame does not make the next ones slower
+    constexpr unsigned MAX_STEPS_PER_FRAME = 4;
+    constexpr SolverMode SOLVER_MODE = SolverMode::Coloring;
+    constexpr unsigned JACOBI_ITERATIONS = 1;
+    constexpr SpatialIndex SPATIAL_INDEX = SpatialIndex::LinearQuadTree;
+    constexpr bool PARALLEL_TREE_BUILD = true;
+    constexpr float HASH_GRID_CELL_SIZE = 4.0f * RADIUS_MAX;
+
+    // Adaptive steps, a particle moves at most a fraction of CFL_LENGTH per step, from its speed and acceleration
+    // Steps stay between DT_MIN and DT_MAX, the frame still lasts DT
+    constexpr bool ADAPTIVE_TIMESTEP = false;
+    constexpr float CFL_NUMBER = 0.4f;
+    constexpr float CFL_LENGTH = RADIUS_MAX;
+    constexpr float DT_MIN = DT / 32.0f;
+    constexpr float DT_MAX = DT;
+
+    // Spatial structures are reused across substeps until a particle moved further than this
+    constexpr float REBUILD_TOLERANCE = 0.5f * RADIUS_MAX;
+
+    // Verlet neighbor lists, valid while particles moved less than half the skin, which is the rebuild tolerance
+    constexpr bool USE_NEIGHBOR_LIST = true;
+    constexpr float NEIGHBOR_SKIN = 2.0f * REBUILD_TOLERANCE;
+
+    // Sleeping particles, a particle slower than SLEEP_VELOCITY for SLEEP_STEPS steps is skipped by the solver
+    // until a neighbor faster than WAKE_VELOCITY touches it, velocities are distances per DT, 0 steps disables it
+    // It must also stay within SLEEP_DISTANCE of where it slowed down, so it does not fall asleep at the top of a jump
+    constexpr unsigned SLEEP_STEPS = 64;
+    constexpr float SLEEP_VELOCITY = 0.002f * RADIUS_MAX;
+    constexpr float SLEEP_DISTANCE = 0.01f * RADIUS_MAX;
+    constexpr float WAKE_VELOCITY = 0.01f * RADIUS_MAX;
+
+    // Particle storage reordering along the Z-order curve, an interval of 0 disables it
+    constexpr unsigned REORDER_INTERVAL = 30;
+    constexpr float REORDER_MIN_LOCALITY = 0.9f;
+    constexpr float REORDER_CELL_SIZE = 4.0f * RADIUS_MAX;
+
+    // SPH engine, densities are sums of poly6 over neighbors closer than the smoothing length
+    constexpr float SPH_SMOOTHING_LENGTH = 5.0f * RADIUS_MAX;
+    constexpr unsigned SPH_KERNEL_TABLE_SIZE = 1024;
+    constexpr float SPH_REST_DENSITY = 0.5f;
+    constexpr float SPH_STIFFNESS = 50000.0f;
+    constexpr float SPH_VISCOSITY = 20.0f;
+    const sf::Vector2f SPH_GRAVITY{0.0f, 50.0f};
+
+    // Position Based Fluids engine, same fluid as the SPH engine, density constraints are solved
+    // by Jacobi iterations, the relaxation keeps the multipliers finite for isolated particles
+    constexpr unsigned PBF_ITERATIONS = 4;
+    constexpr float PBF_RELAXATION = 0.01f;
+
     // World - View config
     const sf::Vector2f WORLD_CENTER = {0.f, 0.f};
     constexpr float WORLD_WIDTH = 500.f;
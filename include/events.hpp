@@ -6,8 +6,8 @@
 
 #include "config.hpp"
 
-// Handle all events
-void handle_events(sf::RenderWindow& window, sf::Clock &clock);
+// Handle all events, return the time elapsed since the last call
+float handle_events(sf::RenderWindow& window, sf::Clock &clock);
 
 // Handle quit events that exit the program
 bool quit_events(const sf::Event &event);
@@ -1,37 +1,46 @@
 #pragma once
 
-#include <unordered_map>
-#include <memory>
-#include <math.h>
-#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cmath>
 
 #include <SFML/Graphics.hpp>
 
-#include "grid_cell.hpp"
-#include "hash_function.hpp"
-#include "object.hpp"
+#include "particle_store.hpp"
+#include "box.hpp"
 
 // Hash grid class
+// Unbounded grid, only the cells holding particles are stored, in a flat open-addressing table
+// Particle indices are sorted by cell, every cell points to one contiguous range of them
+// Buffers are kept between builds, so rebuilding or updating makes no heap allocation
+// once the grid has reached its working size
 class HashGrid
 {
 public:
     // Constructor
     HashGrid(const float cell_size);
 
-    // Insert multiple objects in the grid
-    void batch_insert(const std::vector<std::shared_ptr<Object>> &obj_list);
+    // Insert every particle of the store at once
+    void batch_insert(const ParticleStore &particles);
 
-    // Insert an object in the grid
-    void insert(const std::shared_ptr<Object> &obj);
+    // Refresh the grid after particles moved, it is rebuilt only if a particle changed cell
+    void update(const ParticleStore &particles);
 
-    // Remove an object from the grid
-    void remove(const std::shared_ptr<Object> &obj);
+    // Find all particles in the cell of the position or neighbor cells
+    std::vector<uint32_t> query(const sf::Vector2f &pos) const;
 
-    // Update an object from the grid
-    void update(const std::shared_ptr<Object> &obj);
+    // Append all particles in the cell of the position or neighbor cells to a caller-supplied buffer
+    void query(const sf::Vector2f &pos, std::vector<uint32_t> &objects_found) const;
 
-    // Find all objects in the cells or neighbor cells
-    std::vector<std::shared_ptr<Object>> query(const sf::Vector2f &pos) const;
+    // Append indices of all particles in the given range to a caller-supplied buffer
+    void query(const Box &b, std::vector<uint32_t> &objects_found) const;
+
+    // Call fn(index) for each particle in the given range, without building a result
+    template <typename F>
+    void for_each_in(const Box &b, F &&fn) const;
+
+    // Particles that moved less than margin since the build are still found by range queries
+    void set_margin(const float margin);
 
     // Clear grid
     void clear();
@@ -40,19 +49,106 @@ public:
     size_t count() const;
 
 private:
+    // Cell of the table, count is 0 for an empty slot
+    struct Slot
+    {
+        uint64_t key;
+        uint32_t begin;
+        uint32_t count;
+    };
+
     // Spacing between cells
     float cell_size;
 
-    // Grid
-    std::unordered_map<GridCell, std::vector<std::shared_ptr<Object>>, HashFunction> grid;
+    // Particle store the indices refer to
+    const ParticleStore *particles = nullptr;
+
+    // Distance particles may have moved since the build
+    float margin = 0.0f;
 
-    // Index where the object is stored in the vector
-    // std::unordered_map<std::shared_ptr<Object>, std::pair<unsigned, std::shared_ptr<GridCell>>> index;
+    // Open-addressing table, its size is a power of two at least twice the number of particles
+    std::vector<Slot> table;
+    uint64_t mask = 0;
 
-    // Store where each object is in the grid
-    std::unordered_map<std::shared_ptr<Object>, std::shared_ptr<GridCell>> obj_to_cell;
+    // Particle indices sorted by cell, and the slot of each particle
+    std::vector<uint32_t> objects;
+    std::vector<uint32_t> particle_slot;
 
-    // Convert position to a grid cell coord
-    GridCell get_cell(const sf::Vector2f &pos) const;
+    // Pack the coords of the cell holding a position in a 64 bits key
+    uint64_t get_key(const sf::Vector2f &pos) const;
+
+    // Pack cell coords in a 64 bits key
+    static uint64_t pack(const int32_t x, const int32_t y);
+
+    // Find the slot of a key, or the empty slot where it would be inserted
+    uint32_t find_slot(const uint64_t key) const;
+
+    // Call fn(index) for each particle of a cell
+    template <typename F>
+    void for_each_in_cell(const int32_t x, const int32_t y, F &fn) const;
 };
 
+// Pack cell coords in a 64 bits key
+inline uint64_t HashGrid::pack(const int32_t x, const int32_t y)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+}
+
+// Pack the coords of the cell holding a position in a 64 bits key
+inline uint64_t HashGrid::get_key(const sf::Vector2f &pos) const
+{
+    const int32_t x = static_cast<int32_t>(std::floor(pos.x / cell_size));
+    const int32_t y = static_cast<int32_t>(std::floor(pos.y / cell_size));
+    return pack(x, y);
+}
+
+// Find the slot of a key, or the empty slot where it would be inserted
+inline uint32_t HashGrid::find_slot(const uint64_t key) const
+{
+    // Fibonacci hashing spreads neighbor cells over the table, then linear probing
+    uint64_t slot = (key * 0x9E3779B97F4A7C15ull) >> 32;
+    while (true)
+    {
+        slot &= mask;
+        const Slot &s = table[slot];
+        if (s.count == 0 || s.key == key)
+            return static_cast<uint32_t>(slot);
+        ++slot;
+    }
+}
+
+// Call fn(index) for each particle of a cell
+template <typename F>
+void HashGrid::for_each_in_cell(const int32_t x, const int32_t y, F &fn) const
+{
+    if (table.empty())
+        return;
+
+    const Slot &s = table[find_slot(pack(x, y))];
+    for (uint32_t k = s.begin; k < s.begin + s.count; ++k)
+        fn(objects[k]);
+}
+
+// Call fn(index) for each particle in the given range
+template <typename F>
+void HashGrid::for_each_in(const Box &b, F &&fn) const
+{
+    // Cells covered by the range, grown by the margin
+    const Boundary bounds = b.get_boundary();
+    const int32_t xmin = static_cast<int32_t>(std::floor((bounds.xmin - margin) / cell_size));
+    const int32_t xmax = static_cast<int32_t>(std::floor((bounds.xmax + margin) / cell_size));
+    const int32_t ymin = static_cast<int32_t>(std::floor((bounds.ymin - margin) / cell_size));
+    const int32_t ymax = static_cast<int32_t>(std::floor((bounds.ymax + margin) / cell_size));
+
+    auto visit = [&](const uint32_t i)
+    {
+        if (b.contains(particles->get_position(i)))
+            fn(i);
+    };
+
+    for (int32_t x = xmin; x <= xmax; ++x)
+    {
+        for (int32_t y = ymin; y <= ymax; ++y)
+            for_each_in_cell(x, y, visit);
+    }
+}
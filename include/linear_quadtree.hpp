@@ -0,0 +1,275 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <SFML/Graphics.hpp>
+
+#include "box.hpp"
+#include "morton.hpp"
+#include "radix_sort.hpp"
+#include "particle_store.hpp"
+
+// Pointerless QuadTree
+// Stores indices of the objects of a container T, which must provide get_position(index) and size()
+// Objects are sorted by Morton key, the node hierarchy is implicit: a node at a given level holds
+// every key sharing the same prefix, which is one contiguous range of the sorted array
+template<typename T>
+class LinearQuadTree : public sf::Drawable
+{
+
+public:
+    // Constructor
+    LinearQuadTree(const Box &b);
+
+    // Remove every object, buffers are kept for the next build
+    void clear();
+
+    // Insert every object (particle) of the container at once, in parallel
+    void batch_insert(const T &container);
+
+    // Find indices of all objects in the given range
+    std::vector<uint32_t> query(const Box &b) const;
+
+    // Append indices of all objects in the given range to a caller-supplied buffer
+    void query(const Box &b, std::vector<uint32_t> &objects_found) const;
+
+    // Call fn(index) for each object in the given range, without building a result
+    template <typename F>
+    void for_each_in(const Box &b, F &&fn) const;
+
+    // Objects that moved less than margin since the build are still found by queries
+    void set_margin(const float margin);
+
+private:
+    // Nodes holding at most this number of objects are scanned instead of subdivided
+    static constexpr unsigned node_capacity = 16;
+
+    // Covered area, lower corner and size
+    sf::Vector2f origin;
+    sf::Vector2f size;
+
+    // Number of finest cells per unit
+    sf::Vector2f scale;
+
+    // Container the indices refer to
+    const T *container = nullptr;
+
+    // Distance objects may have moved since the build
+    float margin = 0.0f;
+
+    // Sorted keys, with the matching indices and positions at build time
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> indices;
+    std::vector<float> xs, ys;
+
+    // Scratch buffers for the sort
+    std::vector<uint32_t> tmp_keys;
+    std::vector<uint32_t> tmp_indices;
+    std::vector<size_t> thread_counts;
+
+    // Call fn(index) for each object of the node in the given range
+    // The node at the given level starts at key first_key and holds the sorted objects [begin, end)
+    template <typename F>
+    void for_each_in(const unsigned level, const uint64_t first_key, const size_t begin, const size_t end,
+                     const sf::Vector2f &node_origin, const sf::Vector2f &node_size,
+                     const Boundary &range, F &fn) const;
+
+    // Split the objects of a node between its four children
+    void split(const unsigned level, const uint64_t first_key, const size_t begin, const size_t end, size_t bounds[5]) const;
+
+    // Draw the given node and its children
+    void draw(sf::RenderTarget &target, const sf::RenderStates &states, const unsigned level, const uint64_t first_key,
+              const size_t begin, const size_t end, const sf::Vector2f &node_origin, const sf::Vector2f &node_size) const;
+
+    // Draw QuadTree
+    virtual void draw(sf::RenderTarget &target, sf::RenderStates states) const
+    {
+        draw(target, states, 0, 0, 0, keys.size(), origin, size);
+    }
+};
+
+
+// Constructor
+template <typename T>
+LinearQuadTree<T>::LinearQuadTree(const Box &b)
+{
+    origin = b.get_center() - b.get_half_dimension();
+    size = 2.0f * b.get_half_dimension();
+
+    const float nb_cells = static_cast<float>(1u << MORTON_BITS);
+    scale = {nb_cells / size.x, nb_cells / size.y};
+}
+
+// Remove every object, buffers are kept for the next build
+template <typename T>
+void LinearQuadTree<T>::clear()
+{
+    keys.clear();
+    indices.clear();
+    xs.clear();
+    ys.clear();
+}
+
+// Insert every object of the container at once, in parallel
+template <typename T>
+void LinearQuadTree<T>::batch_insert(const T &container)
+{
+    this->container = &container;
+
+    const size_t n = container.size();
+    keys.resize(n);
+    indices.resize(n);
+    xs.resize(n);
+    ys.resize(n);
+
+    // Compute the key of every object
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i)
+    {
+        keys[i] = morton_key(container.get_position(static_cast<uint32_t>(i)), origin, scale);
+        indices[i] = static_cast<uint32_t>(i);
+    }
+
+    radix_sort(keys, indices, tmp_keys, tmp_indices, thread_counts);
+
+    // Copy positions in sorted order, so that queries scan contiguous memory
+#pragma omp parallel for
+    for (size_t k = 0; k < n; ++k)
+    {
+        const sf::Vector2f pos = container.get_position(indices[k]);
+        xs[k] = pos.x;
+        ys[k] = pos.y;
+    }
+}
+
+// Find indices of all objects in the given range
+template <typename T>
+std::vector<uint32_t> LinearQuadTree<T>::query(const Box &b) const
+{
+    // Output array
+    std::vector<uint32_t> objects_found;
+    query(b, objects_found);
+
+    return objects_found;
+}
+
+// Append indices of all objects in the given range to a caller-supplied buffer
+template <typename T>
+void LinearQuadTree<T>::query(const Box &b, std::vector<uint32_t> &objects_found) const
+{
+    for_each_in(b, [&objects_found](const uint32_t i)
+                { objects_found.push_back(i); });
+}
+
+// Call fn(index) for each object in the given range
+template <typename T>
+template <typename F>
+void LinearQuadTree<T>::for_each_in(const Box &b, F &&fn) const
+{
+    for_each_in(0, 0, 0, keys.size(), origin, size, b.get_boundary(), fn);
+}
+
+// Objects that moved less than margin since the build are still found by queries
+template <typename T>
+void LinearQuadTree<T>::set_margin(const float margin)
+{
+    this->margin = margin;
+}
+
+// Call fn(index) for each object of the node in the given range
+template <typename T>
+template <typename F>
+void LinearQuadTree<T>::for_each_in(const unsigned level, const uint64_t first_key, const size_t begin, const size_t end,
+                                    const sf::Vector2f &node_origin, const sf::Vector2f &node_size,
+                                    const Boundary &range, F &fn) const
+{
+    if (begin == end)
+        return;
+
+    // Interrupt if the research zone does not intersect the node
+    // Node bounds are padded by one finest cell, to absorb rounding in the keys, and by the margin
+    const float pad_x = 1.0f / scale.x + margin;
+    const float pad_y = 1.0f / scale.y + margin;
+    if (node_origin.x + node_size.x + pad_x < range.xmin || range.xmax < node_origin.x - pad_x)
+        return;
+    if (node_origin.y + node_size.y + pad_y < range.ymin || range.ymax < node_origin.y - pad_y)
+        return;
+
+    // Small or finest node, check its objects
+    // Positions copied at build time reject most objects, live positions are only read
+    // for the remaining ones when objects may have moved
+    if (end - begin <= node_capacity || level == MORTON_BITS)
+    {
+        for (size_t k = begin; k < end; ++k)
+        {
+            const float x = xs[k];
+            const float y = ys[k];
+            if (range.xmin - margin <= x && x < range.xmax + margin && range.ymin - margin <= y && y < range.ymax + margin)
+            {
+                if (margin == 0.0f)
+                {
+                    fn(indices[k]);
+                    continue;
+                }
+
+                const sf::Vector2f pos = container->get_position(indices[k]);
+                if (range.xmin <= pos.x && pos.x < range.xmax && range.ymin <= pos.y && pos.y < range.ymax)
+                    fn(indices[k]);
+            }
+        }
+        return;
+    }
+
+    // Else do the research on children
+    size_t bounds[5];
+    split(level, first_key, begin, end, bounds);
+
+    const uint64_t child_span = uint64_t{1} << (2 * (MORTON_BITS - level - 1));
+    const sf::Vector2f child_size = node_size / 2.0f;
+    for (unsigned child = 0; child < 4; ++child)
+    {
+        const sf::Vector2f child_origin = node_origin + sf::Vector2f{(child & 1) * child_size.x, (child >> 1) * child_size.y};
+        for_each_in(level + 1, first_key + child * child_span, bounds[child], bounds[child + 1],
+                    child_origin, child_size, range, fn);
+    }
+}
+
+// Split the objects of a node between its four children
+template <typename T>
+void LinearQuadTree<T>::split(const unsigned level, const uint64_t first_key, const size_t begin, const size_t end, size_t bounds[5]) const
+{
+    const uint64_t child_span = uint64_t{1} << (2 * (MORTON_BITS - level - 1));
+
+    bounds[0] = begin;
+    bounds[4] = end;
+    for (unsigned child = 1; child < 4; ++child)
+    {
+        const uint64_t key = first_key + child * child_span;
+        const auto it = std::lower_bound(keys.begin() + bounds[child - 1], keys.begin() + end, key);
+        bounds[child] = static_cast<size_t>(it - keys.begin());
+    }
+}
+
+// Draw the given node and its children
+template <typename T>
+void LinearQuadTree<T>::draw(sf::RenderTarget &target, const sf::RenderStates &states, const unsigned level, const uint64_t first_key,
+                             const size_t begin, const size_t end, const sf::Vector2f &node_origin, const sf::Vector2f &node_size) const
+{
+    target.draw(Box{node_origin + node_size / 2.0f, node_size / 2.0f}, states);
+
+    if (end - begin <= node_capacity || level == MORTON_BITS)
+        return;
+
+    size_t bounds[5];
+    split(level, first_key, begin, end, bounds);
+
+    const uint64_t child_span = uint64_t{1} << (2 * (MORTON_BITS - level - 1));
+    const sf::Vector2f child_size = node_size / 2.0f;
+    for (unsigned child = 0; child < 4; ++child)
+    {
+        const sf::Vector2f child_origin = node_origin + sf::Vector2f{(child & 1) * child_size.x, (child >> 1) * child_size.y};
+        draw(target, states, level + 1, first_key + child * child_span, bounds[child], bounds[child + 1], child_origin, child_size);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+#include <SFML/Graphics.hpp>
+
+// Morton (Z-order) codes: the bits of the x and y cell coords are interleaved,
+// so that sorting by key groups particles that are close in space
+
+// Number of bits per axis, a key uses twice as many
+constexpr unsigned MORTON_BITS = 16;
+
+// Spread the 16 low bits of v so that there is a zero between each bit
+inline uint32_t morton_spread(uint32_t v)
+{
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Interleave cell coords, x bits are the low bit of each pair
+inline uint32_t morton_encode(const uint32_t x, const uint32_t y)
+{
+    return morton_spread(x) | (morton_spread(y) << 1);
+}
+
+// Key of a position, origin is the lower corner of the covered area and scale the number of cells per unit
+// Positions outside the area are clamped to its border cells
+inline uint32_t morton_key(const sf::Vector2f &pos, const sf::Vector2f &origin, const sf::Vector2f &scale)
+{
+    constexpr float max_cell = static_cast<float>((1u << MORTON_BITS) - 1);
+    const float x = std::clamp((pos.x - origin.x) * scale.x, 0.0f, max_cell);
+    const float y = std::clamp((pos.y - origin.y) * scale.y, 0.0f, max_cell);
+    return morton_encode(static_cast<uint32_t>(x), static_cast<uint32_t>(y));
+}
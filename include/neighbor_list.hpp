@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <omp.h>
+
+#include <SFML/Graphics.hpp>
+
+#include "box.hpp"
+#include "particle_store.hpp"
+
+// Verlet neighbor lists
+// Neighbors of every particle are found once with an inflated range (interaction range + skin),
+// then reused while no particle moved by more than half the skin since the build
+// Lists are stored one after the other in a single array, in particle order
+class NeighborList
+{
+
+public:
+    // Build the list of every particle from a spatial structure, in parallel
+    // Neighbors of particle i are the particles in a box of half size range * radius(i) + skin around it
+    template <typename Tree>
+    void build(const ParticleStore &particles, const Tree &tree, const float range, const float skin);
+
+    // Remove every list
+    void clear();
+
+    // Neighbors of particle i found at build time
+    std::span<const uint32_t> get_neighbors(const uint32_t i) const;
+
+    // Call fn(index) for each neighbor of particle i currently in the given range
+    template <typename F>
+    void for_each_in(const uint32_t i, const Box &b, F &&fn) const;
+
+    // Total number of neighbors stored
+    size_t count() const;
+
+private:
+    // Store the lists were built from
+    const ParticleStore *particles = nullptr;
+
+    // Neighbors of particle i are neighbors[offsets[i]] to neighbors[offsets[i + 1] - 1]
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> neighbors;
+
+    // Lists found by each thread, and where each thread writes them
+    std::vector<std::vector<uint32_t>> thread_neighbors;
+    std::vector<uint32_t> thread_offsets;
+};
+
+// Build the list of every particle from a spatial structure
+// Each thread handles a contiguous block of particles, so the result does not depend on the number of threads
+template <typename Tree>
+void NeighborList::build(const ParticleStore &particles, const Tree &tree, const float range, const float skin)
+{
+    this->particles = &particles;
+
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    offsets.resize(nb_particles + 1);
+
+#pragma omp parallel
+    {
+        const unsigned nb_threads = static_cast<unsigned>(omp_get_num_threads());
+        const unsigned thread = static_cast<unsigned>(omp_get_thread_num());
+
+        // Block of particles handled by this thread
+        const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(nb_particles) * thread / nb_threads);
+        const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(nb_particles) * (thread + 1) / nb_threads);
+
+#pragma omp single
+        {
+            thread_neighbors.resize(nb_threads);
+            thread_offsets.assign(nb_threads + 1, 0);
+        }
+
+        // Find neighbors, offsets are local to the thread for now
+        std::vector<uint32_t> &local = thread_neighbors[thread];
+        local.clear();
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            offsets[i] = static_cast<uint32_t>(local.size());
+
+            const float half_size = range * particles.get_radius(i) + skin;
+            const Box query_box{particles.get_position(i), {half_size, half_size}};
+            tree.for_each_in(query_box, [&](const uint32_t j)
+            {
+                if (i != j)
+                    local.push_back(j);
+            });
+        }
+        thread_offsets[thread + 1] = static_cast<uint32_t>(local.size());
+
+#pragma omp barrier
+
+#pragma omp single
+        {
+            for (unsigned t = 0; t < nb_threads; ++t)
+                thread_offsets[t + 1] += thread_offsets[t];
+            neighbors.resize(thread_offsets[nb_threads]);
+            offsets[nb_particles] = thread_offsets[nb_threads];
+        }
+
+        // Move the lists of the thread to their place
+        const uint32_t base = thread_offsets[thread];
+        for (uint32_t i = begin; i < end; ++i)
+            offsets[i] += base;
+        std::copy(local.begin(), local.end(), neighbors.begin() + base);
+    }
+}
+
+// Neighbors of particle i found at build time
+inline std::span<const uint32_t> NeighborList::get_neighbors(const uint32_t i) const
+{
+    return {neighbors.data() + offsets[i], neighbors.data() + offsets[i + 1]};
+}
+
+// Call fn(index) for each neighbor of particle i currently in the given range
+template <typename F>
+void NeighborList::for_each_in(const uint32_t i, const Box &b, F &&fn) const
+{
+    for (const uint32_t j : get_neighbors(i))
+    {
+        if (b.contains(particles->get_position(j)))
+            fn(j);
+    }
+}
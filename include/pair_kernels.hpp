@@ -0,0 +1,47 @@
+#pragma once
+
+#include <span>
+#include <cstdint>
+
+#include <SFML/Graphics.hpp>
+
+#include "particle_store.hpp"
+
+// Pair interaction kernels
+// Each kernel sums the terms applied to one particle i by a list of candidate neighbors,
+// reading positions, radii and masses straight from the SoA arrays of the store
+// Candidates outside the query box of i, and i itself, are masked out, so the list can come
+// from a tree query or from a neighbor list
+// Vector versions process 8 (AVX2) or 16 (AVX-512) candidates at once, the best one supported
+// by the CPU is picked at startup, so the same binary runs everywhere
+// Sums are not done in the same order by every version, results may differ in the last bits
+
+// Instruction sets a kernel can be built for
+enum class PairKernelIsa
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+// Kernels of one instruction set
+struct PairKernels
+{
+    PairKernelIsa isa;
+    const char *name;
+
+    // Pressure force applied to particle i by the candidates in its query box of given half size
+    sf::Vector2f (*pressure)(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size);
+
+    // Displacement of particle i that solves its collisions with the candidates in its query box
+    sf::Vector2f (*collision)(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size);
+};
+
+// Check if the CPU can run the kernels of the given instruction set
+bool pair_kernels_supported(const PairKernelIsa isa);
+
+// Kernels of the given instruction set, scalar ones if it is not supported
+const PairKernels &get_pair_kernels(const PairKernelIsa isa);
+
+// Fastest kernels supported by the CPU, detected on the first call
+const PairKernels &get_pair_kernels();
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include <SFML/Graphics.hpp>
+
+#include "particle_snapshot.hpp"
+
+// Draws particles as textured quads (two triangles each) from a persistent vertex storage
+// Vertices are written in place every frame, visible particles first, and only that prefix is
+// uploaded and drawn, storage only grows when there are more particles than its capacity
+// Visible particles keep their storage order, so the vertices of a frame do not depend on the thread count
+// Vertices are streamed to an sf::VertexBuffer when the GPU supports it, otherwise they are
+// drawn straight from the storage
+class ParticleRenderer : public sf::Drawable
+{
+public:
+    // Constructor, storage holds the quads of capacity particles
+    ParticleRenderer(const sf::Texture &texture, const size_t capacity, const bool use_vertex_buffer);
+
+    // Write the quads of the visible particles, drawn at alpha between their previous and current positions
+    void update(const ParticleSnapshot &particles, const sf::View &view, const float alpha);
+
+    // Number of vertices drawn
+    size_t get_vertex_count() const;
+
+    // Check if vertices are streamed to a vertex buffer
+    bool uses_vertex_buffer() const;
+
+private:
+    // Particle texture
+    const sf::Texture *texture;
+
+    // Particles per block of the visible particles compaction
+    static constexpr size_t block_size = 4096;
+
+    // Vertices of every quad, texture coordinates are written once as they never change
+    std::vector<sf::Vertex> vertices;
+    size_t vertex_count = 0;
+
+    // Number of visible particles in each block, then the index of the first quad the block writes
+    std::vector<size_t> block_offsets;
+
+    // Vertex buffer, created with the capacity of the storage
+    sf::VertexBuffer buffer;
+    bool use_buffer;
+
+    // Grow storage to hold the quads of the given number of particles
+    void reserve(const size_t capacity);
+
+    // Draw the visible quads
+    virtual void draw(sf::RenderTarget &target, sf::RenderStates states) const;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <cstddef>
+
+#include <SFML/Graphics.hpp>
+
+#include "particle_store.hpp"
+
+// Copy of what the renderer needs from the particles after a simulation step
+// Written by the simulation thread and read by the render thread, through a TripleBuffer
+struct ParticleSnapshot
+{
+    // Positions after the last step and before it, the renderer draws particles in between
+    std::vector<float> x, y;
+    std::vector<float> x_previous, y_previous;
+
+    // Graphic params
+    std::vector<float> radius;
+    std::vector<sf::Color> color;
+
+    // When the step was published
+    std::chrono::steady_clock::time_point time;
+
+    // Copy the particles, vectors keep their memory from one capture to the next
+    void capture(const ParticleStore &particles);
+
+    // Number of particles
+    size_t size() const;
+};
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "config.hpp"
+
+// Particles stored as a structure of arrays, each particle is addressed by its index
+// Hot loops stream over contiguous arrays instead of chasing one heap object per particle
+class ParticleStore
+{
+public:
+    // Constructor
+    ParticleStore() = default;
+
+    // Reserve memory for the given number of particles
+    void reserve(const size_t capacity);
+
+    // Add a particle, return its index
+    uint32_t add(const float radius,
+                 const sf::Color &color,
+                 const float mass,
+                 const sf::Vector2f &position,
+                 const sf::Vector2f &velocity,
+                 const sf::Vector2f &acceleration);
+
+    // Number of particles stored
+    size_t size() const;
+
+    // Retrieve particle position
+    sf::Vector2f get_position(const uint32_t i) const;
+
+    // Retrieve particle velocity, the distance travelled during the last step
+    sf::Vector2f get_velocity(const uint32_t i) const;
+
+    // Retrieve particle acceleration, the sum of the forces applied since the last update
+    sf::Vector2f get_acceleration(const uint32_t i) const;
+
+    // Retrieve particle radius
+    float get_radius(const uint32_t i) const;
+
+    // Retrieve particle color
+    sf::Color get_color(const uint32_t i) const;
+
+    // Retrieve particle mass
+    float get_mass(const uint32_t i) const;
+
+    // Update particle position, velocity, acceleration
+    void update(const uint32_t i, const float dt);
+
+    // Apply a force to the particle
+    void apply_force(const uint32_t i, const sf::Vector2f &force);
+
+    // Reset particle acceleration
+    void reset_acceleration(const uint32_t i);
+
+    // Check collision between two particles
+    bool is_colliding(const uint32_t i, const uint32_t j) const;
+
+    // Solve collision between two particles
+    void solve_collision(const uint32_t i, const uint32_t j);
+
+    // Displacement of particle i that solves its collision with particle j, j is left untouched
+    sf::Vector2f collision_correction(const uint32_t i, const uint32_t j) const;
+
+    // Write the position of particle i for the next iteration, current positions are left untouched
+    void set_next_position(const uint32_t i, const sf::Vector2f &position);
+
+    // Make the next positions current, after every particle has written its own
+    void swap_positions();
+
+    // Check if the particle is asleep, it is then left out of the solver
+    bool is_asleep(const uint32_t i) const;
+
+    // Wake particle i, it keeps its position and starts at rest
+    void wake(const uint32_t i);
+
+    // Ask particle i to wake at its next update_sleep, any thread can ask for any particle
+    void request_wake(const uint32_t i);
+
+    // Wake particle i if it was asked to, then count the steps it stayed slow and in place, it sleeps after SLEEP_STEPS
+    // dt is the step the velocities were measured over, thresholds are distances per DT
+    void update_sleep(const uint32_t i, const float dt);
+
+    // Handle boundaries
+    void handle_boundaries(const uint32_t i, const float xmin, const float xmax, const float ymin, const float ymax);
+
+    // Move particle order[k] to index k, for every k
+    void reorder(const std::vector<uint32_t> &order);
+
+    // Current index of a particle, given the index add() returned for it (its handle)
+    uint32_t get_index(const uint32_t handle) const;
+
+    // Handle of the particle stored at the given index
+    uint32_t get_handle(const uint32_t i) const;
+
+    // Remember current positions, to measure how far particles move from them
+    void save_reference_positions();
+
+    // Largest distance travelled by a particle since the last save_reference_positions
+    // Infinite if positions were never saved or particles were added since
+    float max_displacement() const;
+
+    // Largest velocity of a particle, as a distance travelled during the last step
+    float max_velocity() const;
+
+    // Scale every velocity by the given ratio, when the next step is ratio times as long as the last one
+    // Velocities are distances travelled during a step, so position_old is moved to keep the speed
+    void rescale_velocities(const float ratio);
+
+    // Remember current positions as the state before the next step, the renderer interpolates from them
+    void save_previous_positions();
+
+    // Raw arrays, for kernels that stream over every particle
+    const float *get_x() const;
+    const float *get_y() const;
+    const float *get_x_previous() const;
+    const float *get_y_previous() const;
+    const float *get_radii() const;
+    const float *get_masses() const;
+    const sf::Color *get_colors() const;
+
+private:
+    // Physic params
+    std::vector<float> x, y;
+    std::vector<float> x_old, y_old;
+    std::vector<float> x_next, y_next;
+    std::vector<float> ax, ay;
+    std::vector<float> mass;
+
+    // Steps each particle stayed slower than the sleep velocity, where it slowed down, and wake requests from its neighbors
+    std::vector<uint32_t> still_steps;
+    std::vector<float> x_still, y_still;
+    std::vector<uint8_t> wake_requests;
+
+    // Graphic params
+    std::vector<float> radius;
+    std::vector<sf::Color> color;
+
+    // Positions saved by save_previous_positions
+    std::vector<float> x_previous, y_previous;
+
+    // Positions saved by save_reference_positions
+    std::vector<float> x_ref, y_ref;
+
+    // Remap tables between handles and current indices, updated by reorder
+    std::vector<uint32_t> handles;
+    std::vector<uint32_t> indices;
+
+    // Scratch buffers for reorder
+    std::vector<float> float_scratch;
+    std::vector<sf::Color> color_scratch;
+    std::vector<uint32_t> handle_scratch;
+    std::vector<uint8_t> flag_scratch;
+
+    // Change color based on speed, measured as a distance per DT from a step of dt
+    void change_color(const uint32_t i, const float dt);
+};
+
+// Per particle accessors are defined here so they can be inlined in hot loops
+
+// Number of particles stored
+inline size_t ParticleStore::size() const
+{
+    return x.size();
+}
+
+// Retrieve particle position
+inline sf::Vector2f ParticleStore::get_position(const uint32_t i) const
+{
+    return {x[i], y[i]};
+}
+
+// Retrieve particle velocity, the distance travelled during the last step
+inline sf::Vector2f ParticleStore::get_velocity(const uint32_t i) const
+{
+    return {x[i] - x_old[i], y[i] - y_old[i]};
+}
+
+// Retrieve particle acceleration, the sum of the forces applied since the last update
+inline sf::Vector2f ParticleStore::get_acceleration(const uint32_t i) const
+{
+    return {ax[i], ay[i]};
+}
+
+// Retrieve particle radius
+inline float ParticleStore::get_radius(const uint32_t i) const
+{
+    return radius[i];
+}
+
+// Retrieve particle color
+inline sf::Color ParticleStore::get_color(const uint32_t i) const
+{
+    return color[i];
+}
+
+// Retrieve particle mass
+inline float ParticleStore::get_mass(const uint32_t i) const
+{
+    return mass[i];
+}
+
+// Current index of a particle, given its handle
+inline uint32_t ParticleStore::get_index(const uint32_t handle) const
+{
+    return indices[handle];
+}
+
+// Handle of the particle stored at the given index
+inline uint32_t ParticleStore::get_handle(const uint32_t i) const
+{
+    return handles[i];
+}
+
+// Update particle position, velocity, acceleration
+inline void ParticleStore::update(const uint32_t i, const float dt)
+{
+    const float vx = x[i] - x_old[i];
+    const float vy = y[i] - y_old[i];
+
+    // Save current position
+    x_old[i] = x[i];
+    y_old[i] = y[i];
+
+    // Update position
+    x[i] += vx + ax[i] * dt * dt;
+    y[i] += vy + ay[i] * dt * dt;
+    reset_acceleration(i);
+
+    // Change color based on speed
+    change_color(i, dt);
+}
+
+// Apply a force to the particle
+inline void ParticleStore::apply_force(const uint32_t i, const sf::Vector2f &force)
+{
+    ax[i] += force.x;
+    ay[i] += force.y;
+}
+
+// Reset particle acceleration
+inline void ParticleStore::reset_acceleration(const uint32_t i)
+{
+    ax[i] = 0.0f;
+    ay[i] = 0.0f;
+}
+
+// Check collision between two particles
+inline bool ParticleStore::is_colliding(const uint32_t i, const uint32_t j) const
+{
+    const float dx = x[i] - x[j];
+    const float dy = y[i] - y[j];
+    const float threshold = radius[i] + radius[j];
+
+    return dx * dx + dy * dy <= threshold * threshold;
+}
+
+// Solve collision between two particles
+inline void ParticleStore::solve_collision(const uint32_t i, const uint32_t j)
+{
+    const float dx = x[i] - x[j];
+    const float dy = y[i] - y[j];
+    const float dist = std::sqrt(dx * dx + dy * dy);
+
+    // Calculate overlap
+    const float overlap = (radius[i] + radius[j]) - dist;
+
+    if (overlap > 0)
+    {
+        // Normalize the distance vector
+        const float nx = dx / dist;
+        const float ny = dy / dist;
+
+        // Mass ratio
+        const float total_mass = mass[i] + mass[j];
+        const float ratio_other = mass[j] / total_mass;
+        const float ratio_current = mass[i] / total_mass;
+
+        // Move particles apart
+        x[i] += nx * (overlap * ratio_other * conf::PARTICLE_DAMPING);
+        y[i] += ny * (overlap * ratio_other * conf::PARTICLE_DAMPING);
+        x[j] -= nx * (overlap * ratio_current * conf::PARTICLE_DAMPING);
+        y[j] -= ny * (overlap * ratio_current * conf::PARTICLE_DAMPING);
+    }
+}
+
+// Displacement of particle i that solves its collision with particle j
+inline sf::Vector2f ParticleStore::collision_correction(const uint32_t i, const uint32_t j) const
+{
+    const float dx = x[i] - x[j];
+    const float dy = y[i] - y[j];
+    const float dist = std::sqrt(dx * dx + dy * dy);
+
+    // Calculate overlap
+    const float overlap = (radius[i] + radius[j]) - dist;
+
+    if (overlap <= 0 || dist == 0)
+        return {0.0f, 0.0f};
+
+    // Particle i only moves by its share of the overlap
+    const float ratio_other = mass[j] / (mass[i] + mass[j]);
+    const float factor = overlap * ratio_other * conf::PARTICLE_DAMPING / dist;
+
+    return {dx * factor, dy * factor};
+}
+
+// Write the position of particle i for the next iteration
+inline void ParticleStore::set_next_position(const uint32_t i, const sf::Vector2f &position)
+{
+    x_next[i] = position.x;
+    y_next[i] = position.y;
+}
+
+// Check if the particle is asleep
+inline bool ParticleStore::is_asleep(const uint32_t i) const
+{
+    return conf::SLEEP_STEPS > 0 && still_steps[i] >= conf::SLEEP_STEPS;
+}
+
+// Wake particle i, it keeps its position and starts at rest
+inline void ParticleStore::wake(const uint32_t i)
+{
+    still_steps[i] = 0;
+    wake_requests[i] = 0;
+}
+
+// Ask particle i to wake at its next update_sleep
+inline void ParticleStore::request_wake(const uint32_t i)
+{
+#pragma omp atomic write
+    wake_requests[i] = 1;
+}
+
+// Wake particle i if it was asked to, then count the steps it stayed slow and in place
+inline void ParticleStore::update_sleep(const uint32_t i, const float dt)
+{
+    if (wake_requests[i])
+    {
+        wake(i);
+        return;
+    }
+
+    if (conf::SLEEP_STEPS == 0 || is_asleep(i))
+        return;
+
+    // Velocities are distances per step of dt
+    const float to_dt = conf::DT / dt;
+    const float vx = (x[i] - x_old[i]) * to_dt;
+    const float vy = (y[i] - y_old[i]) * to_dt;
+    const float dx = x[i] - x_still[i];
+    const float dy = y[i] - y_still[i];
+    if (vx * vx + vy * vy >= conf::SLEEP_VELOCITY * conf::SLEEP_VELOCITY ||
+        dx * dx + dy * dy >= conf::SLEEP_DISTANCE * conf::SLEEP_DISTANCE)
+    {
+        still_steps[i] = 0;
+        x_still[i] = x[i];
+        y_still[i] = y[i];
+        return;
+    }
+
+    // Falls asleep at rest, so it does not keep the velocity it had when woken
+    if (++still_steps[i] == conf::SLEEP_STEPS)
+    {
+        x_old[i] = x[i];
+        y_old[i] = y[i];
+    }
+}
+
+// Change color based on speed
+inline void ParticleStore::change_color(const uint32_t i, const float dt)
+{
+    // Same scale whatever the number of substeps, velocities are distances per step of dt
+    const float vx = x[i] - x_old[i];
+    const float vy = y[i] - y_old[i];
+    const float speed = std::sqrt(vx * vx + vy * vy) * conf::DT / dt;
+
+    // Clamp between 0 and 1
+    const float normalized_speed = std::clamp(speed, 0.0f, 1.0f);
+
+    // Interpolate between blue (0, 0, 255) and red (255, 0, 0)
+    const uint8_t r = static_cast<uint8_t>(255 * normalized_speed);
+    const uint8_t b = static_cast<uint8_t>(255 * (1 - normalized_speed));
+
+    color[i] = {r, 0, b};
+}
@@ -1,13 +1,19 @@
 #pragma once
 
-#include <memory>
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
 
 #include <SFML/Graphics.hpp>
 
 #include "box.hpp"
-#include "particle.hpp"
+#include "particle_store.hpp"
 
 // QuadTree class
+// Stores indices of the objects of a container T, which must provide get_position(index) and size()
+// Nodes live in a contiguous pool that is reset, not freed, by clear(), so rebuilding
+// the tree every frame makes no heap allocation once the pool has reached its working size
 template<typename T>
 class QuadTree : public sf::Drawable
 {
@@ -17,139 +23,230 @@ public:
     QuadTree(const Box &b);
 
     // Move constructor
-    QuadTree(QuadTree &&other) noexcept;
+    QuadTree(QuadTree &&other) noexcept = default;
 
     // Move operator
-    QuadTree &operator=(QuadTree &&other) noexcept;
+    QuadTree &operator=(QuadTree &&other) noexcept = default;
 
-    // Insert multiple objetcs (particles) at once
-    void batch_insert(const std::vector<std::shared_ptr<T>> &particles);
+    // Remove every object, nodes are kept in the pool for the next build
+    void clear();
 
-    // Insert an object (particle) in the node
-    bool insert(const std::shared_ptr<T> &p);
+    // Insert every object (particle) of the container at once
+    void batch_insert(const T &container);
 
-    // Find all objects in the given range
-    std::vector<std::shared_ptr<T>> query(const Box &b) const;
+    // Insert every object of the container at once, subtrees are built by parallel tasks
+    // The tree must be empty, the result is the same tree as batch_insert
+    void parallel_batch_insert(const T &container);
+
+    // Insert an object (particle) in the tree, given its index in the container
+    bool insert(const uint32_t i);
+
+    // Find indices of all objects in the given range
+    std::vector<uint32_t> query(const Box &b) const;
+
+    // Append indices of all objects in the given range to a caller-supplied buffer
+    // Nothing is allocated once the buffer has grown to its working size
+    void query(const Box &b, std::vector<uint32_t> &objects_found) const;
+
+    // Call fn(index) for each object in the given range, without building a result
+    template <typename F>
+    void for_each_in(const Box &b, F &&fn) const;
+
+    // Objects that moved less than margin since the build are still found by queries
+    void set_margin(const float margin);
 
 private:
     // Number of elements that can be stored in a node
-    const unsigned node_capacity = 16;
+    static constexpr unsigned node_capacity = 16;
+
+    // Marks a node without children
+    static constexpr uint32_t no_children = 0;
+
+    // Subtrees with more objects are built by a separate task
+    static constexpr uint32_t task_threshold = 1024;
+
+    // Nodes with more objects are partitioned by several tasks
+    static constexpr uint32_t partition_threshold = 1 << 16;
+
+    // Maximum number of blocks of a parallel partition
+    static constexpr uint32_t max_blocks = 64;
+
+    // Node of the QuadTree, objects are stored inline
+    struct Node
+    {
+        sf::Vector2f center;
+        sf::Vector2f half_dimension;
+
+        // Index of the first of the four children (north west, north east, south west, south east)
+        uint32_t children = no_children;
+
+        // Indices of the objects (particles) of this node
+        uint32_t count = 0;
+        std::array<uint32_t, node_capacity> objects;
+    };
+
+    // Container the indices refer to
+    const T *container = nullptr;
 
-    // Box
-    Box boundary;
+    // Distance objects may have moved since the build
+    float margin = 0.0f;
 
-    // Objects (particles) of this node of the QuadTree
-    std::vector<std::shared_ptr<T>> objects;
+    // Node pool, the root is nodes[0], only the first nb_nodes are part of the tree
+    std::vector<Node> nodes;
+    uint32_t nb_nodes = 1;
 
-    // Children
-    std::unique_ptr<QuadTree> north_west = nullptr;
-    std::unique_ptr<QuadTree> north_east = nullptr;
-    std::unique_ptr<QuadTree> south_west = nullptr;
-    std::unique_ptr<QuadTree> south_east = nullptr;
+    // Indices of the objects being sorted by the parallel build, and scratch buffer
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> order_tmp;
 
-    // Subdivide the QuadTree into four new children
-    void subdivide();
+    // Insert an object in the given node
+    bool insert(const uint32_t node, const uint32_t i, const sf::Vector2f &pos);
+
+    // Subdivide the node into four new children, taken from the pool at index first
+    void subdivide(const uint32_t node, const uint32_t first);
+
+    // Build the subtree of a node from the objects src[begin, end), in insertion order
+    // The objects passed to the children are written to dst, at the same positions
+    void build(const uint32_t node, uint32_t *src, uint32_t *dst, const uint32_t begin, const uint32_t end);
+
+    // Stable partition of src[begin, end) into dst[begin, end) by bucket(index), between 0 and 4
+    // Objects of bucket 4 are dropped, bounds receives the first position of each bucket and the end of the last one
+    template <typename F>
+    void partition(const uint32_t *src, uint32_t *dst, const uint32_t begin, const uint32_t end, F &&bucket, uint32_t bounds[5]) const;
+
+    // Call fn(index) for each object of the given node in the given range
+    template <typename F>
+    void for_each_in(const uint32_t node, const Boundary &range, F &fn) const;
+
+    // Check if the node contains a position
+    static bool contains(const Node &node, const sf::Vector2f &pos);
+
+    // Check if the node, grown by the margin, intersects a range
+    bool intersect(const Node &node, const Boundary &range) const;
 
     // Draw QuadTree
     virtual void draw(sf::RenderTarget &target, sf::RenderStates states) const
     {
-        target.draw(boundary, states);
-
-        if (north_west != nullptr)
-        {
-            north_west->draw(target, states);
-            north_east->draw(target, states);
-            south_west->draw(target, states);
-            south_east->draw(target, states);
-        }
+        for (uint32_t node = 0; node < nb_nodes; ++node)
+            target.draw(Box{nodes[node].center, nodes[node].half_dimension}, states);
     }
 };
 
 
 // Constructor
 template <typename T>
-QuadTree<T>::QuadTree(const Box &b) : boundary(b)
+QuadTree<T>::QuadTree(const Box &b)
 {
-    objects.reserve(node_capacity);
+    Node root;
+    root.center = b.get_center();
+    root.half_dimension = b.get_half_dimension();
+    nodes.push_back(root);
 }
 
-// Move constructor
+// Remove every object, nodes are kept in the pool for the next build
 template <typename T>
-QuadTree<T>::QuadTree(QuadTree &&other) noexcept : boundary(std::move(other.boundary)),
-                                                   objects(std::move(other.objects)),
-                                                   north_west(std::move(other.north_west)),
-                                                   north_east(std::move(other.north_east)),
-                                                   south_west(std::move(other.south_west)),
-                                                   south_east(std::move(other.south_east))
+void QuadTree<T>::clear()
 {
+    nb_nodes = 1;
+    nodes[0].children = no_children;
+    nodes[0].count = 0;
 }
 
-// Move operator
+// Insert every object of the container at once
 template <typename T>
-QuadTree<T> &QuadTree<T>::operator=(QuadTree &&other) noexcept
+void QuadTree<T>::batch_insert(const T &container)
 {
-    if (this != &other)
-    {
-        boundary = std::move(other.boundary);
-        objects = std::move(other.objects);
-        north_west = std::move(other.north_west);
-        north_east = std::move(other.north_east);
-        south_west = std::move(other.south_west);
-        south_east = std::move(other.south_east);
-    }
-    return *this;
+    this->container = &container;
+
+    const uint32_t n = static_cast<uint32_t>(container.size());
+    for (uint32_t i = 0; i < n; ++i)
+        insert(0, i, container.get_position(i));
 }
 
-// Insert multiple objects at once
+// Insert every object of the container at once, subtrees are built by parallel tasks
 template <typename T>
-void QuadTree<T>::batch_insert(const std::vector<std::shared_ptr<T>> &objects)
+void QuadTree<T>::parallel_batch_insert(const T &container)
 {
-    for (auto &p : objects)
+    this->container = &container;
+
+    const uint32_t n = static_cast<uint32_t>(container.size());
+
+    // A node only subdivides once it holds node_capacity objects, so the size of the pool is bounded
+    // and nodes can be taken from it concurrently
+    const uint32_t max_nodes = 1 + 4 * (n / node_capacity);
+    if (nodes.size() < max_nodes)
+        nodes.resize(max_nodes);
+
+    order.resize(n);
+    order_tmp.resize(n);
+
+#pragma omp parallel
+#pragma omp single
     {
-        if (boundary.contains(*p))
-            insert(p);
+#pragma omp taskloop
+        for (uint32_t i = 0; i < n; ++i)
+            order_tmp[i] = i;
+
+        // Drop objects outside of the root, then build from it
+        uint32_t bounds[5];
+        partition(order_tmp.data(), order.data(), 0, n, [this](const uint32_t i)
+                  { return contains(nodes[0], this->container->get_position(i)) ? 0 : 4; }, bounds);
+
+        build(0, order.data(), order_tmp.data(), bounds[0], bounds[1]);
     }
 }
 
-// Insert an object in the node
+// Insert an object in the tree
+template <typename T>
+bool QuadTree<T>::insert(const uint32_t i)
+{
+    return insert(0, i, container->get_position(i));
+}
+
+// Insert an object in the given node
 template <typename T>
-bool QuadTree<T>::insert(const std::shared_ptr<T> &p)
+bool QuadTree<T>::insert(const uint32_t node, const uint32_t i, const sf::Vector2f &pos)
 {
-    // Ignore object that dont belong to the QuadTree
-    if (!boundary.contains(*p))
+    // Ignore object that dont belong to the node
+    if (!contains(nodes[node], pos))
         return false;
 
     // Check if there is enough place to insert the object
-    if (objects.size() < node_capacity)
+    if (nodes[node].count < node_capacity)
     {
-        objects.push_back(p);
+        nodes[node].objects[nodes[node].count++] = i;
         return true;
     }
 
-    // Else subdivise the QuadTree and add the object to the node
-    if (north_west == nullptr)
-        subdivide();
+    // Else subdivise the node and add the object to a child
+    // The pool may grow here, so nodes are accessed by index only
+    if (nodes[node].children == no_children)
+    {
+        const uint32_t first = nb_nodes;
+        nb_nodes += 4;
+        if (nodes.size() < nb_nodes)
+            nodes.resize(nb_nodes);
+        subdivide(node, first);
+    }
 
-    if (north_west->insert(p))
-        return true;
-    if (north_east->insert(p))
-        return true;
-    if (south_west->insert(p))
-        return true;
-    if (south_east->insert(p))
-        return true;
+    const uint32_t first = nodes[node].children;
+    for (uint32_t child = first; child < first + 4; ++child)
+    {
+        if (insert(child, i, pos))
+            return true;
+    }
 
     // Point cannot be inserted (should not happen)
     return false;
 }
 
-// Subdivide the QuadTree into four new children
+// Subdivide the node into four new children, taken from the pool at index first
 template <typename T>
-void QuadTree<T>::subdivide()
+void QuadTree<T>::subdivide(const uint32_t node, const uint32_t first)
 {
     // Retrieve current node params
-    const sf::Vector2f &center = boundary.get_center();
-    const sf::Vector2f &hdim = boundary.get_half_dimension();
+    const sf::Vector2f center = nodes[node].center;
+    const sf::Vector2f hdim = nodes[node].half_dimension;
 
     // Define children boxes params
     const sf::Vector2f box_dim = hdim / 2.0f;
@@ -159,51 +256,204 @@ void QuadTree<T>::subdivide()
     const sf::Vector2f sw_center = center + sf::Vector2f{-hdim.x / 2.0f, hdim.y / 2.0f};
     const sf::Vector2f se_center = center + sf::Vector2f{hdim.x / 2.0f, hdim.y / 2.0f};
 
-    // Build boxes based on params
-    Box nw_box{nw_center, box_dim};
-    Box ne_box{ne_center, box_dim};
-    Box sw_box{sw_center, box_dim};
-    Box se_box{se_center, box_dim};
+    nodes[first + 0].center = nw_center;
+    nodes[first + 1].center = ne_center;
+    nodes[first + 2].center = sw_center;
+    nodes[first + 3].center = se_center;
 
-    // Build children using boxes created
-    north_west = std::make_unique<QuadTree>(nw_box);
-    north_east = std::make_unique<QuadTree>(ne_box);
-    south_west = std::make_unique<QuadTree>(sw_box);
-    south_east = std::make_unique<QuadTree>(se_box);
+    for (uint32_t child = first; child < first + 4; ++child)
+    {
+        nodes[child].half_dimension = box_dim;
+        nodes[child].children = no_children;
+        nodes[child].count = 0;
+    }
+
+    nodes[node].children = first;
 }
 
-// Find all objects in the given range
+// Build the subtree of a node from the objects src[begin, end), in insertion order
 template <typename T>
-std::vector<std::shared_ptr<T>> QuadTree<T>::query(const Box &b) const
+void QuadTree<T>::build(const uint32_t node, uint32_t *src, uint32_t *dst, const uint32_t begin, const uint32_t end)
+{
+    // The node keeps the first objects, as if they were inserted one by one
+    const uint32_t count = std::min(end - begin, node_capacity);
+    std::copy(src + begin, src + begin + count, nodes[node].objects.begin());
+    nodes[node].count = count;
+    nodes[node].children = no_children;
+
+    if (begin + count == end)
+        return;
+
+    // Else subdivise the node and send the other objects to the first child containing them
+    uint32_t first;
+#pragma omp atomic capture
+    {
+        first = nb_nodes;
+        nb_nodes += 4;
+    }
+    subdivide(node, first);
+
+    uint32_t bounds[5];
+    partition(src, dst, begin + count, end, [this, first](const uint32_t i)
+    {
+        const sf::Vector2f pos = container->get_position(i);
+        uint32_t child = 0;
+        while (child < 4 && !contains(nodes[first + child], pos))
+            ++child;
+        return child;
+    }, bounds);
+
+    // Children own disjoint ranges, large ones are built by another task
+    for (uint32_t child = 0; child < 4; ++child)
+    {
+        const uint32_t child_begin = bounds[child];
+        const uint32_t child_end = bounds[child + 1];
+        if (child_end - child_begin > task_threshold)
+        {
+#pragma omp task
+            build(first + child, dst, src, child_begin, child_end);
+        }
+        else
+            build(first + child, dst, src, child_begin, child_end);
+    }
+}
+
+// Stable partition of src[begin, end) into dst[begin, end) by bucket(index)
+template <typename T>
+template <typename F>
+void QuadTree<T>::partition(const uint32_t *src, uint32_t *dst, const uint32_t begin, const uint32_t end, F &&bucket, uint32_t bounds[5]) const
+{
+    // Number of objects per bucket in each block, then where each block writes
+    const uint32_t size = end - begin;
+    const uint32_t nb_blocks = std::min(max_blocks, size / partition_threshold + 1);
+    std::array<std::array<uint32_t, 5>, max_blocks> counts{};
+
+#pragma omp taskloop if (nb_blocks > 1) shared(counts)
+    for (uint32_t block = 0; block < nb_blocks; ++block)
+    {
+        const uint32_t block_begin = begin + static_cast<uint32_t>(uint64_t{size} * block / nb_blocks);
+        const uint32_t block_end = begin + static_cast<uint32_t>(uint64_t{size} * (block + 1) / nb_blocks);
+        for (uint32_t k = block_begin; k < block_end; ++k)
+            counts[block][bucket(src[k])]++;
+    }
+
+    // Offsets, bucket by bucket then block by block, keeps the partition stable
+    uint32_t offset = begin;
+    for (uint32_t b = 0; b < 5; ++b)
+    {
+        bounds[b] = offset;
+        for (uint32_t block = 0; block < nb_blocks; ++block)
+        {
+            const uint32_t c = counts[block][b];
+            counts[block][b] = offset;
+            offset += c;
+        }
+    }
+
+#pragma omp taskloop if (nb_blocks > 1) shared(counts)
+    for (uint32_t block = 0; block < nb_blocks; ++block)
+    {
+        const uint32_t block_begin = begin + static_cast<uint32_t>(uint64_t{size} * block / nb_blocks);
+        const uint32_t block_end = begin + static_cast<uint32_t>(uint64_t{size} * (block + 1) / nb_blocks);
+        for (uint32_t k = block_begin; k < block_end; ++k)
+        {
+            const uint32_t i = src[k];
+            const uint32_t b = bucket(i);
+            if (b < 4)
+                dst[counts[block][b]++] = i;
+        }
+    }
+}
+
+// Find indices of all objects in the given range
+template <typename T>
+std::vector<uint32_t> QuadTree<T>::query(const Box &b) const
 {
     // Output array
-    std::vector<std::shared_ptr<T>> objects_found;
+    std::vector<uint32_t> objects_found;
+    query(b, objects_found);
 
-    // Interrupt if the research zone does not intersect the QuadTree
-    if (!boundary.intersect(b))
-        return objects_found;
+    return objects_found;
+}
 
-    // Check objets in the QuadTree
-    for (const auto &p : objects)
+// Append indices of all objects in the given range to a caller-supplied buffer
+template <typename T>
+void QuadTree<T>::query(const Box &b, std::vector<uint32_t> &objects_found) const
+{
+    for_each_in(b, [&objects_found](const uint32_t i)
+                { objects_found.push_back(i); });
+}
+
+// Call fn(index) for each object in the given range
+template <typename T>
+template <typename F>
+void QuadTree<T>::for_each_in(const Box &b, F &&fn) const
+{
+    for_each_in(0, b.get_boundary(), fn);
+}
+
+// Objects that moved less than margin since the build are still found by queries
+template <typename T>
+void QuadTree<T>::set_margin(const float margin)
+{
+    this->margin = margin;
+}
+
+// Call fn(index) for each object of the given node in the given range
+template <typename T>
+template <typename F>
+void QuadTree<T>::for_each_in(const uint32_t node, const Boundary &range, F &fn) const
+{
+    const Node &n = nodes[node];
+
+    // Interrupt if the research zone does not intersect the node
+    if (!intersect(n, range))
+        return;
+
+    // Check objets in the node
+    for (uint32_t k = 0; k < n.count; ++k)
     {
-        if (b.contains(*p))
-            objects_found.push_back(p);
+        const uint32_t i = n.objects[k];
+        const sf::Vector2f pos = container->get_position(i);
+        if (range.xmin <= pos.x && pos.x < range.xmax && range.ymin <= pos.y && pos.y < range.ymax)
+            fn(i);
     }
 
     // Stop if no children
-    if (north_west == nullptr)
-        return objects_found;
+    if (n.children == no_children)
+        return;
 
     // Else do the research on children
-    const auto nw_objects = north_west->query(b);
-    const auto ne_objects = north_east->query(b);
-    const auto sw_objects = south_west->query(b);
-    const auto se_objects = south_east->query(b);
+    for (uint32_t child = n.children; child < n.children + 4; ++child)
+        for_each_in(child, range, fn);
+}
 
-    objects_found.insert(objects_found.end(), nw_objects.begin(), nw_objects.end());
-    objects_found.insert(objects_found.end(), ne_objects.begin(), ne_objects.end());
-    objects_found.insert(objects_found.end(), sw_objects.begin(), sw_objects.end());
-    objects_found.insert(objects_found.end(), se_objects.begin(), se_objects.end());
+// Check if the node contains a position
+template <typename T>
+bool QuadTree<T>::contains(const Node &node, const sf::Vector2f &pos)
+{
+    const float xmin = node.center.x - node.half_dimension.x;
+    const float xmax = node.center.x + node.half_dimension.x;
+    const float ymin = node.center.y - node.half_dimension.y;
+    const float ymax = node.center.y + node.half_dimension.y;
 
-    return objects_found;
-}
\ No newline at end of file
+    return xmin <= pos.x && pos.x < xmax && ymin <= pos.y && pos.y < ymax;
+}
+
+// Check if the node, grown by the margin, intersects a range
+template <typename T>
+bool QuadTree<T>::intersect(const Node &node, const Boundary &range) const
+{
+    const float xmin = node.center.x - node.half_dimension.x - margin;
+    const float xmax = node.center.x + node.half_dimension.x + margin;
+    const float ymin = node.center.y - node.half_dimension.y - margin;
+    const float ymax = node.center.y + node.half_dimension.y + margin;
+
+    // Check if a box is on the left of the other, or above the other
+    if (xmax < range.xmin || range.xmax < xmin)
+        return false;
+    if (ymax < range.ymin || range.ymax < ymin)
+        return false;
+
+    return true;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Sort values by their 32-bit keys, in parallel
+// Least significant digit first, 8 bits per pass, the sort is stable so the result
+// does not depend on the number of threads
+// tmp_keys, tmp_values and thread_counts are scratch buffers, kept by the caller so that they can be reused
+void radix_sort(std::vector<uint32_t> &keys,
+                std::vector<uint32_t> &values,
+                std::vector<uint32_t> &tmp_keys,
+                std::vector<uint32_t> &tmp_values,
+                std::vector<size_t> &thread_counts);
@@ -5,38 +5,78 @@
 #include <omp.h>
 #include <memory>
 
-#include "particle.hpp"
+#include "particle_store.hpp"
 #include "config.hpp"
 #include "box.hpp"
 #include "quadtree.hpp"
+#include "linear_quadtree.hpp"
+#include "hash_grid.hpp"
+#include "spatial_sort.hpp"
 
 // Abstract class containing the world to simulate (particles and how to update them)
 class Simulation {
 
 public:
     // Constructor
-    Simulation(const std::vector<std::shared_ptr<Particle>> &particles, const Box &world_box, const float dt, const unsigned nb_substep);
+    Simulation(const ParticleStore &particles, const Box &world_box, const float dt, const unsigned nb_substep);
 
     // Define here how to update the simulation
     virtual void update() = 0;
 
     // Retrieve particles to draw them
-    const std::vector<std::shared_ptr<Particle>>& get_particles() const;
+    const ParticleStore& get_particles() const;
 
     // Get current QuadTree
-    const QuadTree<Particle>& get_quadtree() const;
+    const QuadTree<ParticleStore>& get_quadtree() const;
+
+    // Get current LinearQuadTree
+    const LinearQuadTree<ParticleStore>& get_linear_quadtree() const;
+
+    // Choose the structure used to find neighbor particles
+    void set_spatial_index(const SpatialIndex index);
+
+    // Choose whether steps are chosen from the CFL condition instead of dividing dt in nb_substep
+    void set_adaptive_timestep(const bool enabled);
+
+    // Length of the last step
+    float get_step_dt() const;
 
 protected:
     // Particles of the simulation
-    std::vector<std::shared_ptr<Particle>> particles;
+    ParticleStore particles;
 
     // World border
     Box world_box;
 
     // QuadTree, will be updated every time the update function is called (just so we can draw it)
-    QuadTree<Particle> qt;
+    QuadTree<ParticleStore> qt;
+
+    // Structure used to find neighbor particles, only the selected one is updated
+    SpatialIndex spatial_index;
+    LinearQuadTree<ParticleStore> lqt;
+    HashGrid hg;
+
+    // Set when the structures to build changed, so that they are rebuilt on the next update
+    bool force_rebuild = true;
+
+    // Keeps particles close in space close in memory
+    SpatialSort spatial_sort;
 
     // Delta time and substeps for more accurate result
     float dt;
     unsigned nb_substep;
+
+    // Adaptive steps, velocities are distances travelled during the last step so they are kept with its length
+    bool adaptive_timestep;
+    float step_dt;
+    float max_acceleration = 0.0f;
+
+    // Rebuild the selected structure from the current positions
+    void build_tree();
+
+    // Length of the next step, at most time_left, velocities are rescaled if it changed
+    float next_step_dt(const float time_left);
+
+    // Apply the force and update every particle, the largest acceleration bounds the next step
+    void integrate(const float sub_dt, const sf::Vector2f &force);
 };
\ No newline at end of file
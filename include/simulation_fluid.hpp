@@ -1,6 +1,8 @@
 // #pragma once
 
 #include "simulation.hpp"
+#include "spatial_grid.hpp"
+#include "neighbor_list.hpp"
 
 // Extended class of Simulation to do a fluid simulation
 class SimulationFluid : public Simulation
@@ -8,18 +10,73 @@ class SimulationFluid : public Simulation
 
 public:
     // Constructor
-    SimulationFluid(const std::vector<std::shared_ptr<Particle>> &particles, const Box &world_box, const float dt, const unsigned nb_substep);
+    SimulationFluid(const ParticleStore &particles, const Box &world_box, const float dt, const unsigned nb_substep);
 
-    // Update the simulation
+    // Update the simulation by one frame, made of nb_substep substeps, or of adaptive substeps
     virtual void update();
 
+    // Choose how particle interactions are resolved
+    void set_solver_mode(const SolverMode mode);
+
+    // Choose whether solvers iterate Verlet neighbor lists instead of querying the spatial structure
+    void set_neighbor_list(const bool enabled);
+
 private:
+    // Solver used to resolve particle interactions
+    SolverMode solver_mode;
+
+    // Grid used by the coloring solver, cells are at least as large as the interaction range
+    SpatialGrid grid;
+
+    // Verlet neighbor lists, rebuilt with the spatial structure
+    bool use_neighbor_list;
+    NeighborList neighbor_list;
+
+    // Check if the solver reads neighbors from the lists
+    bool uses_neighbor_list() const;
+
+    // Check if the solver finds neighbors in the grid cells
+    bool uses_grid() const;
+
+    // Rebuild the selected structure, and the grid of the coloring solver
+    void build_spatial_index();
+
+    // Run one substep using the given neighbor search structure
+    template <typename Tree>
+    void update(const Tree &tree, const float sub_dt);
+
+    // Substep with every interaction inside a critical section
+    template <typename Tree>
+    void update_critical(const Tree &tree, const float sub_dt);
+
+    // Substep with cells processed by independent color classes
+    void update_coloring(const float sub_dt);
+
+    // Substep visiting every pair once, cells against themselves and their 4 forward neighbors
+    void update_half_neighbor(const float sub_dt);
+
+    // Substep with double-buffered Jacobi iterations, each particle only writes to itself
+    template <typename Tree>
+    void update_jacobi(const Tree &tree, const float sub_dt);
+
+    // Build a grid covering the world, with cells as small as the interaction range allows
+    static SpatialGrid make_interaction_grid(const ParticleStore &particles, const Box &world_box);
+
+    // Apply every interaction between two particles
+    void interact(const uint32_t i, const uint32_t j, const float sub_dt);
+
+    // Apply every interaction between two particles visited only once, if they are in range
+    void interact_once(const uint32_t i, const uint32_t j, const float sub_dt);
+
+    // Pressure force applied to particle i by particle j
+    sf::Vector2f compute_pressure(const uint32_t i, const uint32_t j) const;
+
     // Apply pressure force to the given particles
-    static void apply_pressure(std::shared_ptr<Particle> &p, std::shared_ptr<Particle> &neighbor, const float dt);
+    void apply_pressure(const uint32_t i, const uint32_t j, const float dt);
 
     // Apply viscosity force to the given particles
-    static void apply_viscosity(std::shared_ptr<Particle> &p, std::shared_ptr<Particle> &neighbor, const float dt);
+    void apply_viscosity(const uint32_t i, const uint32_t j, const float dt);
 
     // Apply cohesion force to the given particles
-    static void apply_cohesion(std::shared_ptr<Particle> &p, std::shared_ptr<Particle> &neighbor, const float dt);
+    void apply_cohesion(const uint32_t i, const uint32_t j, const float dt);
 };
\ No newline at end of file
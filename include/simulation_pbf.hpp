@@ -0,0 +1,55 @@
+#pragma once
+
+#include "simulation.hpp"
+#include "sph_kernels.hpp"
+
+// Extended class of Simulation to do a Position Based Fluids simulation
+// Particles are first moved by the Verlet update, then their positions are corrected so that
+// the density around each particle does not exceed the rest density
+// Corrections are Jacobi iterations: every particle reads the current positions and writes
+// only its own next position, the velocity follows from position and position_old
+class SimulationPBF : public Simulation
+{
+
+public:
+    // Constructor
+    SimulationPBF(const ParticleStore &particles, const Box &world_box, const float dt, const unsigned nb_substep);
+
+    // Update the simulation by one frame, made of nb_substep substeps, or of adaptive substeps
+    virtual void update();
+
+    // Choose the number of Jacobi iterations on the density constraints per substep
+    void set_iterations(const unsigned iterations);
+
+    // Density of particle i at the last iteration
+    float get_density(const uint32_t i) const;
+
+private:
+    // Smoothing kernels, for the fixed smoothing length
+    SphKernels kernels;
+
+    // Jacobi iterations per substep
+    unsigned iterations;
+
+    // Set when the structures must be rebuilt before the next query
+    bool rebuild = true;
+
+    // Density and constraint multiplier of every particle, by index
+    std::vector<float> densities;
+    std::vector<float> lambdas;
+
+    // Rebuild the selected structure if a particle moved further than the tolerance
+    void refresh_tree();
+
+    // Run one iteration using the given neighbor search structure
+    template <typename Tree>
+    void solve(const Tree &tree);
+
+    // Density and constraint multiplier of every particle
+    template <typename Tree>
+    void compute_lambdas(const Tree &tree);
+
+    // Move every particle to satisfy the constraints of its neighbors
+    template <typename Tree>
+    void apply_corrections(const Tree &tree);
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "simulation.hpp"
+#include "sph_kernels.hpp"
+
+// Extended class of Simulation to do a Smoothed Particle Hydrodynamics fluid simulation
+// Every substep computes the density of each particle, then the pressure and viscosity forces,
+// each pass is a parallel gather over the neighbors found in the selected spatial structure
+class SimulationSPH : public Simulation
+{
+
+public:
+    // Constructor
+    SimulationSPH(const ParticleStore &particles, const Box &world_box, const float dt, const unsigned nb_substep);
+
+    // Update the simulation by one frame, made of nb_substep substeps, or of adaptive substeps
+    virtual void update();
+
+    // Density of particle i at the last substep
+    float get_density(const uint32_t i) const;
+
+private:
+    // Smoothing kernels, for the fixed smoothing length
+    SphKernels kernels;
+
+    // Density and pressure of every particle, by index
+    std::vector<float> densities;
+    std::vector<float> pressures;
+
+    // Run one substep using the given neighbor search structure
+    template <typename Tree>
+    void update(const Tree &tree, const float sub_dt);
+
+    // Density and pressure of every particle
+    template <typename Tree>
+    void compute_densities(const Tree &tree);
+
+    // Apply pressure and viscosity forces to every particle
+    template <typename Tree>
+    void apply_forces(const Tree &tree, const float sub_dt);
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+#include <SFML/Graphics.hpp>
+
+#include "particle_store.hpp"
+
+// Draws particles on the CPU into an RGBA framebuffer, for runs without window or OpenGL context
+// Particles are discs with the color given by their speed, the view is split in square tiles drawn
+// in parallel, each tile fills the spans of the discs that overlap it
+// Particles are binned to the tiles they overlap by a counting sort that keeps their storage order,
+// so a frame does not depend on the thread count
+class SoftwareRenderer
+{
+public:
+    // Constructor, the view is scaled to fit the image and centered in it
+    SoftwareRenderer(const unsigned width, const unsigned height, const sf::Vector2f &view_center, const sf::Vector2f &view_size);
+
+    // Draw every particle on a black background
+    void render(const ParticleStore &particles);
+
+    // Image size
+    unsigned get_width() const;
+    unsigned get_height() const;
+
+    // Pixels, row by row, 4 bytes (red, green, blue, alpha) per pixel
+    const uint8_t *get_pixels() const;
+
+    // Write the image as a binary PPM file (alpha is dropped)
+    bool save_ppm(const std::string &path);
+
+    // Write the image as a PNG file
+    bool save_png(const std::string &path);
+
+    // Write the raw RGBA pixels, to pipe frames to an encoder
+    bool write_raw(std::FILE *file) const;
+
+private:
+    // Size of the square tiles in pixels
+    static constexpr unsigned tile_size = 64;
+
+    // Particles are binned by at most this number of blocks in parallel
+    static constexpr uint32_t max_blocks = 64;
+
+    // Image size, and number of tiles along each axis
+    unsigned width, height;
+    unsigned nb_tiles_x, nb_tiles_y;
+
+    // Pixels per world unit, and world position of the top left corner of the image
+    float scale;
+    sf::Vector2f origin;
+
+    // Pixels packed in memory order red, green, blue, alpha
+    std::vector<uint32_t> pixels;
+
+    // Number of particles per block and tile, then where each block writes in the tile lists
+    std::vector<uint32_t> block_offsets;
+
+    // First entry of each tile in the tile lists, and indices of the particles overlapping each tile
+    std::vector<uint32_t> tile_starts;
+    std::vector<uint32_t> tile_particles;
+
+    // Rows written by save_ppm, and image written by save_png, kept from one frame to the next
+    std::vector<uint8_t> rgb;
+    sf::Image image;
+
+    // Sort particles by the tiles they overlap
+    void bin(const ParticleStore &particles);
+
+    // Draw the particles binned to a tile
+    void draw_tile(const ParticleStore &particles, const unsigned tile);
+};
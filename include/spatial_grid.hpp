@@ -1,15 +1,20 @@
 #pragma once
 
-#include <memory>
 #include <vector>
+#include <array>
+#include <span>
+#include <cstdint>
+#include <algorithm>
 
 #include <SFML/Graphics.hpp>
 
 #include "box.hpp"
-#include "object.hpp"
+#include "particle_store.hpp"
 
 // Divide space into cells of same size
 // For bounded environment
+// Particle indices are sorted by cell (counting sort), cells are stored row by row,
+// so the particles of neighbor cells on the same row are contiguous
 class SpatialGrid
 {
 
@@ -17,24 +22,74 @@ public:
     // Constructor
     SpatialGrid(const sf::Vector2f center, const float width, const float height, const unsigned num_cells_x, const unsigned num_cells_y);
 
-    // Insert an object in the grid
-    void insert(const std::shared_ptr<Object> &obj);
-
-    // Remove an object from the grid
-    void remove(const std::shared_ptr<Object> &obj);
+    // Sort every particle of the store by cell, in parallel
+    void batch_insert(const ParticleStore &particles);
 
     // Clear the grid
     void clear();
 
-    // Find objects near given object
-    std::vector<std::shared_ptr<Object>> query(const std::shared_ptr<Object> &obj) const;
+    // Find particles in the 3x3 cells around the given position, one contiguous range per row
+    std::array<std::span<const uint32_t>, 3> query(const sf::Vector2f &pos) const;
+
+    // Find particles in the 3x3 cells around the given cell, one contiguous range per row
+    std::array<std::span<const uint32_t>, 3> query_cell(const unsigned x, const unsigned y) const;
+
+    // Particles of the given cell
+    std::span<const uint32_t> get_cell(const unsigned x, const unsigned y) const;
+
+    // Call fn(index) for each particle in the given range
+    template <typename F>
+    void for_each_in(const Box &b, F &&fn) const;
+
+    // Number of cells along each axis
+    unsigned get_num_x() const;
+    unsigned get_num_y() const;
 
 private:
     sf::Vector2f center;
     float width, height;
     unsigned num_x, num_y;
-    
+
     sf::Vector2f cell_size;
 
-    std::vector<std::vector<std::shared_ptr<Object>>> grid;
+    // Lower corner of the grid
+    sf::Vector2f origin;
+
+    // Store the grid was built from
+    const ParticleStore *particles = nullptr;
+
+    // Particles of cell c are indices[cell_start[c]] to indices[cell_start[c + 1] - 1]
+    std::vector<uint32_t> cell_start;
+    std::vector<uint32_t> indices;
+
+    // Cell of each particle, and number of particles per cell counted by each thread
+    std::vector<uint32_t> particle_cell;
+    std::vector<uint32_t> thread_counts;
+
+    // Convert position to cell coords, clamped to the grid
+    unsigned cell_x(const float x) const;
+    unsigned cell_y(const float y) const;
+
+    // Particles of cells x_first to x_last of row y
+    std::span<const uint32_t> get_row(const unsigned y, const unsigned x_first, const unsigned x_last) const;
 };
+
+// Call fn(index) for each particle in the given range
+template <typename F>
+void SpatialGrid::for_each_in(const Box &b, F &&fn) const
+{
+    const Boundary bounds = b.get_boundary();
+    const unsigned x_first = cell_x(bounds.xmin);
+    const unsigned x_last = cell_x(bounds.xmax);
+    const unsigned y_first = cell_y(bounds.ymin);
+    const unsigned y_last = cell_y(bounds.ymax);
+
+    for (unsigned y = y_first; y <= y_last; ++y)
+    {
+        for (const uint32_t i : get_row(y, x_first, x_last))
+        {
+            if (b.contains(particles->get_position(i)))
+                fn(i);
+        }
+    }
+}
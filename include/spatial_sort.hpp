@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <SFML/Graphics.hpp>
+
+#include "box.hpp"
+#include "particle_store.hpp"
+
+// Reorders particle storage along the Z-order (Morton) curve, so that particles close in space
+// are also close in memory and neighbor loops hit the cache
+// The order slowly degrades as particles move, it is measured every few frames and particles
+// are sorted again once it falls below a threshold
+// Indices change on every sort, external handles must be mapped with ParticleStore::get_index
+class SpatialSort
+{
+public:
+    // Constructor, locality is measured with cells of the given size
+    SpatialSort(const Box &world_box, const float cell_size, const unsigned interval, const float min_locality);
+
+    // Called once per frame, sort particles if the locality check is due and fails
+    // Return true if particles were reordered
+    bool update(ParticleStore &particles);
+
+    // Sort particles along the curve
+    void sort(ParticleStore &particles);
+
+    // Fraction of consecutive particles whose cells follow the curve order, 1 right after a sort
+    float measure_locality(const ParticleStore &particles);
+
+private:
+    // Covered area, lower corner, and number of finest cells per unit
+    sf::Vector2f origin;
+    sf::Vector2f scale;
+
+    // Number of low key bits ignored when measuring locality
+    unsigned coarse_shift;
+
+    // Frames between two locality checks, and locality under which particles are sorted
+    unsigned interval;
+    float min_locality;
+    unsigned frame = 0;
+
+    // Keys and order of the particles, with scratch buffers for the sort
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> tmp_keys;
+    std::vector<uint32_t> tmp_order;
+    std::vector<size_t> thread_counts;
+
+    // Compute the key of every particle
+    void compute_keys(const ParticleStore &particles);
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+// SPH smoothing kernels in 2D, for a fixed smoothing length h
+// Poly6 for the density, spiky for the pressure, viscosity kernel for the viscosity
+// Kernels are functions of the squared distance r2, so pair loops need no square root:
+// poly6 is a polynomial of r2, the others are read from tables sampled along r2
+class SphKernels
+{
+public:
+    // Constructor, tables hold table_size samples between 0 and h * h
+    SphKernels(const float smoothing_length, const unsigned table_size);
+
+    // Smoothing length
+    float get_smoothing_length() const;
+
+    // Poly6 kernel W(r)
+    float density(const float r2) const;
+
+    // Gradient of the spiky kernel divided by r, the gradient at d = xi - xj is pressure_gradient(r2) * d
+    float pressure_gradient(const float r2) const;
+
+    // Laplacian of the viscosity kernel
+    float viscosity(const float r2) const;
+
+private:
+    // Smoothing length and its square
+    float h, h2;
+
+    // Poly6 normalization
+    float poly6_coef;
+
+    // Number of samples per unit of r2
+    float scale;
+
+    // Tables sampled every 1 / scale along r2, with one extra sample at h2
+    std::vector<float> spiky_table;
+    std::vector<float> viscosity_table;
+
+    // Linear interpolation in a table, 0 beyond the smoothing length
+    float lookup(const std::vector<float> &table, const float r2) const;
+};
+
+// Poly6 kernel W(r)
+inline float SphKernels::density(const float r2) const
+{
+    if (r2 >= h2)
+        return 0.0f;
+
+    const float d = h2 - r2;
+    return poly6_coef * d * d * d;
+}
+
+// Gradient of the spiky kernel divided by r
+inline float SphKernels::pressure_gradient(const float r2) const
+{
+    return lookup(spiky_table, r2);
+}
+
+// Laplacian of the viscosity kernel
+inline float SphKernels::viscosity(const float r2) const
+{
+    return lookup(viscosity_table, r2);
+}
+
+// Linear interpolation in a table, 0 beyond the smoothing length
+inline float SphKernels::lookup(const std::vector<float> &table, const float r2) const
+{
+    if (r2 >= h2)
+        return 0.0f;
+
+    const float t = r2 * scale;
+    const size_t k = std::min(static_cast<size_t>(t), table.size() - 2);
+    const float w = t - static_cast<float>(k);
+
+    return table[k] + w * (table[k + 1] - table[k]);
+}
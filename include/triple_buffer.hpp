@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands values from one writer thread to one reader thread without locks
+// Each thread owns one of the three slots, the third one is the latest published value
+// The writer fills its slot and swaps it with the published one, the reader swaps its slot with
+// the published one when a new value is there, so neither thread ever waits for the other
+// Slots are reused, a value holding vectors keeps their memory
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Slot owned by the writer
+    T &back();
+
+    // Publish the writer slot, the writer gets the previously published slot back
+    void publish();
+
+    // Take the latest published slot if the writer published since the last call
+    // Return true if the reader slot changed
+    bool update();
+
+    // Slot owned by the reader, the latest value taken by update
+    const T &front() const;
+
+private:
+    // Set on the published index while the reader has not taken it
+    static constexpr uint8_t fresh = 4;
+
+    std::array<T, 3> slots;
+
+    // Published slot, shared by both threads
+    std::atomic<uint8_t> middle{1};
+
+    // Slots owned by the writer and the reader
+    uint8_t back_index = 0;
+    uint8_t front_index = 2;
+};
+
+// Slot owned by the writer
+template <typename T>
+T &TripleBuffer<T>::back()
+{
+    return slots[back_index];
+}
+
+// Publish the writer slot
+template <typename T>
+void TripleBuffer<T>::publish()
+{
+    back_index = middle.exchange(back_index | fresh, std::memory_order_acq_rel) & ~fresh;
+}
+
+// Take the latest published slot if the writer published since the last call
+template <typename T>
+bool TripleBuffer<T>::update()
+{
+    if (!(middle.load(std::memory_order_relaxed) & fresh))
+        return false;
+
+    front_index = middle.exchange(front_index, std::memory_order_acq_rel) & ~fresh;
+    return true;
+}
+
+// Slot owned by the reader
+template <typename T>
+const T &TripleBuffer<T>::front() const
+{
+    return slots[front_index];
+}
@@ -3,24 +3,6 @@
 // Constructor
 Box::Box(const sf::Vector2f &center, const sf::Vector2f &half_dimension) : center(center), half_dimension(half_dimension)
 {
-    // Draw Box
-    vertices.setPrimitiveType(sf::LineStrip);
-    vertices.resize(5);
-
-    const sf::Vector2f v1 = center + sf::Vector2f{-half_dimension.x, half_dimension.y};
-    const sf::Vector2f v2 = center + half_dimension;
-    const sf::Vector2f v3 = center + sf::Vector2f{half_dimension.x, -half_dimension.y};
-    const sf::Vector2f v4 = center - half_dimension;
-
-    vertices[0].position = v1;
-    vertices[1].position = v2;
-    vertices[2].position = v3;
-    vertices[3].position = v4;
-    vertices[4].position = v1;    
-
-    for (size_t i = 0; i < 5; ++i)
-        vertices[i].color = sf::Color::Green;
-
     // Define boundaries
     boundary.xmin = center.x - half_dimension.x;
     boundary.xmax = center.x + half_dimension.x;
@@ -31,8 +13,12 @@ Box::Box(const sf::Vector2f &center, const sf::Vector2f &half_dimension) : cente
 // Check if the box contains a particle
 bool Box::contains(const Object &p) const
 {
-    const sf::Vector2f &pos = p.get_position();
+    return contains(p.get_position());
+}
 
+// Check if the box contains a position
+bool Box::contains(const sf::Vector2f &pos) const
+{
     const float xmin = center.x - half_dimension.x;
     const float xmax = center.x + half_dimension.x;
     const float ymin = center.y - half_dimension.y;
@@ -80,4 +66,26 @@ sf::Vector2f Box::get_half_dimension() const
 Boundary Box::get_boundary() const
 {
     return boundary;
+}
+
+// Draw box
+void Box::draw(sf::RenderTarget &target, sf::RenderStates states) const
+{
+    sf::VertexArray vertices(sf::LineStrip, 5);
+
+    const sf::Vector2f v1 = center + sf::Vector2f{-half_dimension.x, half_dimension.y};
+    const sf::Vector2f v2 = center + half_dimension;
+    const sf::Vector2f v3 = center + sf::Vector2f{half_dimension.x, -half_dimension.y};
+    const sf::Vector2f v4 = center - half_dimension;
+
+    vertices[0].position = v1;
+    vertices[1].position = v2;
+    vertices[2].position = v3;
+    vertices[3].position = v4;
+    vertices[4].position = v1;
+
+    for (size_t i = 0; i < 5; ++i)
+        vertices[i].color = sf::Color::Green;
+
+    target.draw(vertices, states);
 }
\ No newline at end of file
@@ -2,7 +2,8 @@
 
 #include <iostream>
 
-void handle_events(sf::RenderWindow &window, sf::Clock &clock)
+// Handle all events, return the time elapsed since the last call
+float handle_events(sf::RenderWindow &window, sf::Clock &clock)
 {
     sf::Event event;
 
@@ -23,6 +24,8 @@ void handle_events(sf::RenderWindow &window, sf::Clock &clock)
     // Handle keyboard movement
     if (movement_events(view, conf::SENSITIVITY, dt))
         window.setView(view);
+
+    return dt;
 }
 
 // Handle quit events that exit the program
@@ -1,154 +1,131 @@
 #include "hash_grid.hpp"
 
+#include <algorithm>
+
 // Constructor
 HashGrid::HashGrid(const float cell_size) : cell_size(cell_size)
 {
 }
 
-// Convert position to a grid cell coord
-GridCell HashGrid::get_cell(const sf::Vector2f &pos) const
+// Insert every particle of the store at once
+void HashGrid::batch_insert(const ParticleStore &particles)
 {
-    const int x = static_cast<int>(std::floor(pos.x / cell_size));
-    const int y = static_cast<int>(std::floor(pos.y / cell_size));
-    return GridCell(x, y);
-}
+    this->particles = &particles;
 
-// Insert multiple objects in the grid
-void HashGrid::batch_insert(const std::vector<std::shared_ptr<Object>> &obj_list)
-{
-    for (const auto &obj : obj_list)
-        insert(obj);
-}
+    const uint32_t n = static_cast<uint32_t>(particles.size());
+    particle_slot.resize(n);
+    objects.resize(n);
 
-// Insert an object in the grid
-void HashGrid::insert(const std::shared_ptr<Object> &obj)
-{
-    // Check if object is not already stored in the hashgrid (should be in obj_to_cell)
-    if (obj_to_cell.find(obj) != obj_to_cell.end())
-        return;
+    // Table at least twice as large as the number of cells, which is at most the number of particles
+    size_t capacity = 16;
+    while (capacity < 2 * static_cast<size_t>(n))
+        capacity *= 2;
+    if (table.size() < capacity)
+        table.resize(capacity);
+    mask = table.size() - 1;
 
-    // Store object
-    const GridCell cell = get_cell(obj->get_position());
-    grid[cell].push_back(obj);
+    for (Slot &s : table)
+        s.count = 0;
 
-    // Link
-    obj_to_cell[obj] = std::make_shared<GridCell>(cell);
-    // const size_t i = grid[cell].size() - 1;
-    // index[obj].first = i;
-    // index[obj].second = std::make_shared<GridCell>(cell);
-}
+    // Insert keys and count particles per cell
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        const uint64_t key = get_key(particles.get_position(i));
+        const uint32_t slot = find_slot(key);
+        table[slot].key = key;
+        table[slot].count++;
+        particle_slot[i] = slot;
+    }
 
-// Remove an object from the grid
-void HashGrid::remove(const std::shared_ptr<Object> &obj)
-{
-    // Idea : try to find object, swap it to make it last item, then remove it
+    // First position of each cell, in table order
+    uint32_t offset = 0;
+    for (Slot &s : table)
+    {
+        s.begin = offset;
+        offset += s.count;
+    }
 
-    // Check if object is stored in the hashgrid
-    if (obj_to_cell.find(obj) == obj_to_cell.end())
-        return;
+    // Scatter, particles of a cell stay sorted by index
+    for (uint32_t i = 0; i < n; ++i)
+        objects[table[particle_slot[i]].begin++] = i;
+
+    // Restore first positions
+    for (Slot &s : table)
+        s.begin -= s.count;
+}
 
-    // Check if cell exist
-    // const GridCell cell = get_cell(obj->get_position());
-    // if (grid.find(cell) == grid.end())
-    //     return;
-    
-    // If object is in the hashgrid, we know in which cell it is
-    const auto cell = *obj_to_cell[obj];
-
-    // Find its position
-    std::vector<std::shared_ptr<Object>> &grid_vals = grid[cell];
-    const size_t n = grid_vals.size();
-    // const size_t i = it2->second.first; // index[obj].first;
-
-    size_t i = 0;
-    for (auto &e : grid_vals)
+// Refresh the grid after particles moved
+void HashGrid::update(const ParticleStore &particles)
+{
+    // Another store, or particles added or removed, the slots do not match anymore
+    if (particles.size() != particle_slot.size() || &particles != this->particles)
     {
-        if (e == obj)
-            break;
-        i++;
+        batch_insert(particles);
+        return;
     }
 
-    // Invalid index
-    if (i >= n)
-        return;
+    bool moved = false;
 
-    // Swap if not last element
-    if (i != n - 1)
+#pragma omp parallel for reduction(|| : moved)
+    for (uint32_t i = 0; i < particle_slot.size(); ++i)
     {
-        std::swap(grid_vals[i], grid_vals[n - 1]);
-        // index[grid_vals[i]].first = i;
+        if (!moved && table[particle_slot[i]].key != get_key(particles.get_position(i)))
+            moved = true;
     }
 
-    // Remove last element
-    grid_vals.pop_back();
+    if (moved)
+        batch_insert(particles);
+}
 
-    // Clean up if empty
-    if (grid_vals.empty())
-        grid.erase(cell);
+// Find all particles in the cell of the position or neighbor cells
+std::vector<uint32_t> HashGrid::query(const sf::Vector2f &pos) const
+{
+    std::vector<uint32_t> output;
+    query(pos, output);
 
-    // Remove link
-    // index.erase(obj);
-    obj_to_cell.erase(obj);
+    return output;
 }
 
-// Update an object from the grid
-// TODO: CHANGE THINGS HERE (particles dont collide)
-void HashGrid::update(const std::shared_ptr<Object> &obj)
+// Append all particles in the cell of the position or neighbor cells to a caller-supplied buffer
+void HashGrid::query(const sf::Vector2f &pos, std::vector<uint32_t> &objects_found) const
 {
-    // Check if object is in the grid
-    if (obj_to_cell.find(obj) == obj_to_cell.end())
-        return;
-
-    // Retrieve previous cell associated to the object
-    auto &old_grid_cell = obj_to_cell[obj];
+    const int32_t x = static_cast<int32_t>(std::floor(pos.x / cell_size));
+    const int32_t y = static_cast<int32_t>(std::floor(pos.y / cell_size));
 
-    // Check if update is needed, i.e. check if grid cell is different than before
-    const GridCell new_grid_cell = get_cell(obj->get_position());
+    auto push = [&objects_found](const uint32_t i)
+    { objects_found.push_back(i); };
 
-    if (new_grid_cell != *old_grid_cell)
+    for (int32_t dx = -1; dx <= 1; ++dx)
     {
-        // Remove the object and put it back in the grid
-        remove(obj);
-        insert(obj);
+        for (int32_t dy = -1; dy <= 1; ++dy)
+            for_each_in_cell(x + dx, y + dy, push);
     }
 }
 
-// Find all objects in the cells or neighbor cells
-std::vector<std::shared_ptr<Object>> HashGrid::query(const sf::Vector2f &pos) const
+// Append indices of all particles in the given range to a caller-supplied buffer
+void HashGrid::query(const Box &b, std::vector<uint32_t> &objects_found) const
 {
-    std::vector<std::shared_ptr<Object>> output;
-    const GridCell cell = get_cell(pos);
-
-    for (int dx = -1; dx <= 1; ++dx)
-    {
-        for (int dy = -1; dy <= 1; ++dy)
-        {
-            GridCell neighbor(cell.x() + dx, cell.y() + dy);
-            auto it = grid.find(neighbor);
-            if (it != grid.end())
-            {
-                const std::vector<std::shared_ptr<Object>> &grid_vals = it->second;
-                output.insert(output.end(), grid_vals.begin(), grid_vals.end());
-            }
-        }
-    }
+    for_each_in(b, [&objects_found](const uint32_t i)
+                { objects_found.push_back(i); });
+}
 
-    return output;
+// Particles that moved less than margin since the build are still found by range queries
+void HashGrid::set_margin(const float margin)
+{
+    this->margin = margin;
 }
 
 // Clear grid
 void HashGrid::clear()
 {
-    grid.clear();
-    // index.clear();
+    for (Slot &s : table)
+        s.count = 0;
+    objects.clear();
+    particle_slot.clear();
 }
 
 // Get number of elements stored in grid
 size_t HashGrid::count() const
 {
-    size_t total = 0;
-    for (const auto &p : grid)
-        total += p.second.size();
-    
-    return total;
-}
\ No newline at end of file
+    return objects.size();
+}
@@ -2,33 +2,120 @@
 
 #include <memory>
 #include <random>
+#include <string>
+#include <limits>
+#include <stdexcept>
 #include <thread>
+#include <atomic>
+#include <chrono>
 
 #include <condition_variable>
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 #include "events.hpp"
 #include "config.hpp"
 #include "simulation_fluid.hpp"
-#include "particle.hpp"
+#include "simulation_sph.hpp"
+#include "simulation_pbf.hpp"
+#include "particle_store.hpp"
+#include "particle_renderer.hpp"
+#include "software_renderer.hpp"
+#include "particle_snapshot.hpp"
+#include "triple_buffer.hpp"
 #include "box.hpp"
 #include "quadtree.hpp"
+#include "linear_quadtree.hpp"
 #include "hash_grid.hpp"
+#include "spatial_sort.hpp"
+#include "pair_kernels.hpp"
 #include "utils.hpp"
 
-// Create particle vertex array
-// Uses a texture instead of points
-sf::VertexArray create_particle_array(const std::vector<std::shared_ptr<Particle>> &particles,
-                                      const sf::Texture &texture,
-                                      const sf::RenderWindow &window);
+// Mouse state, written by the render thread and read by the simulation thread
+struct MouseInput
+{
+    std::atomic<float> x{0.0f}, y{0.0f};
+    std::atomic<float> strength{0.0f};
+};
+
+// Neighbor search structures and storage order of the main loop physics, kept from one step to the next
+struct Physics
+{
+    QuadTree<ParticleStore> qt;
+    LinearQuadTree<ParticleStore> lqt;
+    HashGrid hg;
+    SpatialSort spatial_sort;
+    Boundary boundary;
+
+    // Constructor, particles are sorted so that neighbors in space are neighbors in memory
+    Physics(const Box &world_box, ParticleStore &particles);
+};
+
+// Options of a run without window, it stops after steps steps or seconds seconds, whichever comes first
+struct HeadlessOptions
+{
+    std::string engine = "main";
+    unsigned nb_particles = conf::NB_PARTICLES;
+    unsigned steps = 0;
+    float seconds = 0.0f;
+    unsigned seed = 0;
+
+    // Frames drawn by the software renderer every frame_interval steps, none, ppm, png or raw (to stdout)
+    std::string frames = "none";
+    std::string output = "frame_";
+    unsigned frame_interval = 1;
+    unsigned width = conf::WINDOW_WIDTH;
+    unsigned height = conf::WINDOW_HEIGHT;
+};
 
 // Generate random particles with the given parameters and the given seed
-std::vector<std::shared_ptr<Particle>> generate_random_particles(const Params &params, const unsigned seed);
+ParticleStore generate_random_particles(const Params &params, const unsigned seed);
+
+// Run one step of DT, made of SUBSTEPS substeps
+void simulate_step(ParticleStore &particles, Physics &physics, const sf::Vector2f &world_pos, const float strength);
+
+// Read the options of a run without window, return false if they are invalid
+bool parse_headless_options(const int argc, char *argv[], HeadlessOptions &options);
+
+// Run the physics without window or OpenGL context, then print throughput statistics
+int run_headless(const HeadlessOptions &options);
+
+// Run the physics until running is cleared, publish a snapshot of the particles after each batch of steps
+void run_simulation(ParticleStore &particles,
+                    const Box &world_box,
+                    TripleBuffer<ParticleSnapshot> &snapshots,
+                    const MouseInput &mouse,
+                    const std::atomic<bool> &running);
 
 // Update particles
-void update(std::vector<std::shared_ptr<Particle>> &particles, const size_t start, const size_t end, const float dt, const Boundary &boundary, const bool enable_omp);
+void update(ParticleStore &particles, const uint32_t start, const uint32_t end, const float dt, const Boundary &boundary, const bool enable_omp);
+
+// Apply mouse attraction (positive strength) or repulsion (negative strength) to particles near the mouse
+template <typename Tree>
+void apply_mouse_force(ParticleStore &particles, const Tree &tree, const sf::Vector2f &world_pos, const float strength);
 
-int main()
+// Solve collisions using the given neighbor search structure, then apply gravity and update particles
+template <typename Tree>
+void step(ParticleStore &particles, const Tree &tree, const Boundary &boundary, const float dt);
+
+int main(int argc, char *argv[])
 {
+    // Compute nodes have no display, the physics runs alone
+    if (argc > 1 && std::string(argv[1]) == "--headless")
+    {
+        HeadlessOptions options;
+        if (!parse_headless_options(argc, argv, options))
+        {
+            std::cerr << "Usage : " << argv[0] << " --headless [--engine main|fluid|sph|pbf] [--particles N] [--steps N] [--seconds T] [--seed S]"
+                      << " [--frames none|ppm|png|raw] [--output PREFIX] [--frame-interval N] [--width W] [--height H]\n";
+            return 1;
+        }
+        return run_headless(options);
+    }
+
     // Define the window
     sf::RenderWindow window(sf::VideoMode(conf::WINDOW_SIZE.x, conf::WINDOW_SIZE.y), conf::WINDOW_TITLE, sf::Style::Fullscreen);
 
@@ -41,14 +128,10 @@ int main()
     unsigned seed = rd();
 
     // Generate N random particles
-    std::vector<std::shared_ptr<Particle>> particles = generate_random_particles(conf::GENERATOR_PARAMS, seed);
-
-    // Vertex array to draw particles
-    sf::VertexArray array;
+    ParticleStore particles = generate_random_particles(conf::GENERATOR_PARAMS, seed);
 
     // World box
     const Box world_box{conf::WORLD_CENTER, {conf::XMAX, conf::YMAX}};
-    const Boundary boundary = world_box.get_boundary();
 
     // Clock
     sf::Clock clock;
@@ -73,6 +156,9 @@ int main()
     else
         particle_texture.setSmooth(true);
 
+    // Particles are drawn from a persistent vertex storage, streamed to the GPU when possible
+    ParticleRenderer renderer(particle_texture, particles.size(), conf::USE_VERTEX_BUFFER);
+
     // Create HashGrid
     // HashGrid hashgrid(2.0f);
 
@@ -80,18 +166,79 @@ int main()
     // for (const auto &p : particles)
     //     hashgrid.insert(p);
 
+    // Physics runs on its own thread, it owns the particles and publishes a snapshot after its steps
+    // The render thread draws the latest snapshot, neither thread waits for the other
+    TripleBuffer<ParticleSnapshot> snapshots;
+    MouseInput mouse;
+    std::atomic<bool> running{true};
+    std::thread simulation_thread(run_simulation, std::ref(particles), std::cref(world_box), std::ref(snapshots), std::cref(mouse), std::cref(running));
+
     // Main loop
     while (window.isOpen())
     {
         // Events
         handle_events(window, clock);
 
-        // Particles as a vertex array
-        array = create_particle_array(particles, particle_texture, window);
-
         // GOAL : Collision detection + particle update <= 50 ms
         // Initial FPS : 180
 
+        // Mouse attraction -> only to particle near, attraction wins if both buttons are pressed
+        const auto mouse_pos = sf::Mouse::getPosition(window);
+        const auto world_pos = window.mapPixelToCoords(mouse_pos);
+        const bool should_attract = sf::Mouse::isButtonPressed(sf::Mouse::Left);
+        const bool should_repulse = sf::Mouse::isButtonPressed(sf::Mouse::Right);
+        mouse.x = world_pos.x;
+        mouse.y = world_pos.y;
+        mouse.strength = should_attract ? 250.f : (should_repulse ? -250.f : 0.0f);
+
+        // Latest complete snapshot, drawn between its last two steps by the time elapsed since it was published
+        snapshots.update();
+        const ParticleSnapshot &snapshot = snapshots.front();
+        const float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - snapshot.time).count();
+        renderer.update(snapshot, window.getView(), std::clamp(elapsed / conf::DT, 0.0f, 1.0f));
+
+        // Draw
+        window.clear();
+
+        window.draw(renderer);
+        window.draw(world_box);
+        // window.draw(sim.get_quadtree());
+        // window.draw(vertices_drawn);
+
+        window.display();
+    }
+
+    running = false;
+    simulation_thread.join();
+
+    return 0;
+}
+
+// Run the physics until running is cleared
+void run_simulation(ParticleStore &particles,
+                    const Box &world_box,
+                    TripleBuffer<ParticleSnapshot> &snapshots,
+                    const MouseInput &mouse,
+                    const std::atomic<bool> &running)
+{
+    // Neighbor search structures and storage order, kept across steps
+    Physics physics(world_box, particles);
+
+    // Clock, and wall-clock time not simulated yet
+    sf::Clock clock;
+    float accumulator = 0.0f;
+
+    while (running)
+    {
+        accumulator += clock.restart().asSeconds();
+
+        // Wait for the next step instead of spinning
+        if (accumulator < conf::DT)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<float>(conf::DT - accumulator));
+            continue;
+        }
+
         // OpenMP particle update : 165
         // update(particles, 0, conf::NB_PARTICLES, conf::DT, boundary, true);
 
@@ -107,159 +254,290 @@ int main()
         //     }
         // }
 
-        // Quadtree collision detection -> O(log(n))
-        QuadTree<Particle> qt(world_box);
-        qt.batch_insert(particles);
+        // Mouse state of the last rendered frame
+        const sf::Vector2f world_pos{mouse.x, mouse.y};
+        const float strength = mouse.strength;
 
-        // Mouse attraction -> only to particle near
-        const auto mouse_pos = sf::Mouse::getPosition(window);
-        const auto world_pos = window.mapPixelToCoords(mouse_pos);
-        const Box mouse_box{world_pos, {100.0f, 100.0f}};
-        const auto near_mouse = qt.query(mouse_box);
-        const bool should_attract = sf::Mouse::isButtonPressed(sf::Mouse::Left);
-        const bool should_repulse = sf::Mouse::isButtonPressed(sf::Mouse::Right);
+        // As many steps of DT as the elapsed time requires, at most MAX_STEPS_PER_FRAME
+        const unsigned nb_steps = std::min(static_cast<unsigned>(accumulator / conf::DT), conf::MAX_STEPS_PER_FRAME);
+        for (unsigned s = 0; s < nb_steps; ++s)
+        {
+            // The last step is drawn interpolated from the positions before it
+            if (s + 1 == nb_steps)
+                particles.save_previous_positions();
+
+            simulate_step(particles, physics, world_pos, strength);
 
-        // Apply mouse attraction only if near
-        if (should_attract)
+            accumulator -= conf::DT;
+        }
+
+        // Time beyond the cap is dropped instead of being caught up on the next batches
+        if (nb_steps == conf::MAX_STEPS_PER_FRAME)
+            accumulator = std::min(accumulator, conf::DT);
+
+        // Copied into the slot owned by this thread, then handed to the render thread
+        snapshots.back().capture(particles);
+        snapshots.publish();
+    }
+}
+
+// Neighbor search structures and storage order of the main loop physics
+Physics::Physics(const Box &world_box, ParticleStore &particles) : qt(world_box),
+                                                                  lqt(world_box),
+                                                                  hg(conf::HASH_GRID_CELL_SIZE),
+                                                                  spatial_sort(world_box, conf::REORDER_CELL_SIZE, conf::REORDER_INTERVAL, conf::REORDER_MIN_LOCALITY),
+                                                                  boundary(world_box.get_boundary())
+{
+    // Structures are rebuilt from the same buffers once particles moved further than the tolerance
+    qt.set_margin(conf::REBUILD_TOLERANCE);
+    lqt.set_margin(conf::REBUILD_TOLERANCE);
+    hg.set_margin(conf::REBUILD_TOLERANCE);
+
+    // Velocities are generated as distances per DT, substeps move particles by a fraction of it
+    particles.rescale_velocities(1.0f / static_cast<float>(conf::SUBSTEPS));
+
+    // Particles are generated in random order
+    if (conf::REORDER_INTERVAL > 0)
+        spatial_sort.sort(particles);
+}
+
+// Run one step of DT, made of SUBSTEPS substeps
+void simulate_step(ParticleStore &particles, Physics &physics, const sf::Vector2f &world_pos, const float strength)
+{
+    // Sort particles again once their order lost its locality, structures hold indices so they are rebuilt
+    bool rebuild = physics.spatial_sort.update(particles);
+
+    // Several substeps per step, structures are reused until a particle moved further than the tolerance
+    const float sub_dt = conf::DT / static_cast<float>(conf::SUBSTEPS);
+    for (unsigned substep = 0; substep < conf::SUBSTEPS; ++substep)
+    {
+        // Quadtree collision detection -> O(log(n))
+        if (rebuild || particles.max_displacement() > conf::REBUILD_TOLERANCE)
         {
-            for (size_t j = 0; j < near_mouse.size(); ++j)
+            if (conf::SPATIAL_INDEX == SpatialIndex::LinearQuadTree)
             {
-                auto &p = near_mouse[j];
-                sf::Vector2f axis = world_pos - p->get_position();
-                const float length = std::sqrt((axis.x * axis.x) + (axis.y * axis.y));
-                if (length != 0.0f)
-                    axis /= length;
-                p->apply_force(axis * 250.f);
+                physics.lqt.clear();
+                physics.lqt.batch_insert(particles);
             }
-        }
-        else if (should_repulse)
-        {
-            for (size_t j = 0; j < near_mouse.size(); ++j)
+            else if (conf::SPATIAL_INDEX == SpatialIndex::HashGrid)
+                physics.hg.batch_insert(particles);
+            else
             {
-                auto &p = near_mouse[j];
-                sf::Vector2f axis = world_pos - p->get_position();
-                const float length = std::sqrt((axis.x * axis.x) + (axis.y * axis.y));
-                if (length != 0.0f)
-                    axis /= length;
-                p->apply_force(-axis * 250.f);
+                physics.qt.clear();
+                if (conf::PARALLEL_TREE_BUILD)
+                    physics.qt.parallel_batch_insert(particles);
+                else
+                    physics.qt.batch_insert(particles);
             }
+            particles.save_reference_positions();
+            rebuild = false;
         }
 
-#pragma omp parallel for
-        for (size_t i = 0; i < particles.size(); ++i)
+        if (conf::SPATIAL_INDEX == SpatialIndex::LinearQuadTree)
         {
-            auto &p = particles[i];
+            apply_mouse_force(particles, physics.lqt, world_pos, strength);
+            step(particles, physics.lqt, physics.boundary, sub_dt);
+        }
+        else if (conf::SPATIAL_INDEX == SpatialIndex::HashGrid)
+        {
+            apply_mouse_force(particles, physics.hg, world_pos, strength);
+            step(particles, physics.hg, physics.boundary, sub_dt);
+        }
+        else
+        {
+            apply_mouse_force(particles, physics.qt, world_pos, strength);
+            step(particles, physics.qt, physics.boundary, sub_dt);
+        }
+    }
+}
 
-            // Boundary detection
-            p->handle_boundaries(boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+// Read the options of a run without window
+bool parse_headless_options(const int argc, char *argv[], HeadlessOptions &options)
+{
+    // stoul and stof stop at the first invalid character, the whole value must be a number
+    const auto to_unsigned = [](const std::string &value)
+    {
+        size_t pos = 0;
+        const unsigned long number = std::stoul(value, &pos);
+        if (pos != value.size() || number > std::numeric_limits<unsigned>::max())
+            throw std::invalid_argument(value);
+        return static_cast<unsigned>(number);
+    };
+    const auto to_float = [](const std::string &value)
+    {
+        size_t pos = 0;
+        const float number = std::stof(value, &pos);
+        if (pos != value.size())
+            throw std::invalid_argument(value);
+        return number;
+    };
+
+    for (int k = 2; k < argc; k += 2)
+    {
+        if (k + 1 >= argc)
+            return false;
 
-            // Collision detection
-            const Box p_box{p->get_position(), sf::Vector2f{2 * p->get_radius(), 2 * p->get_radius()}};
-            auto neighbors = qt.query(p_box);
-            for (size_t j = 0; j < neighbors.size(); ++j)
-            {
-                auto &neighbor = neighbors[j];
-                if (p != neighbor && p->is_colliding(*neighbor))
-#pragma omp critical
-                {
-                    p->solve_collision(*neighbor);
-                }
-            }
+        const std::string option = argv[k];
+        const std::string value = argv[k + 1];
 
-            // Gravity
-            p->apply_force({0.0f, 50.f});
+        // stoul wraps negative numbers around, and a value starting with a dash is a missing value
+        if (value.empty() || value[0] == '-')
+            return false;
 
-            // Physics update
-            p->update(conf::DT);
+        try
+        {
+            if (option == "--engine")
+                options.engine = value;
+            else if (option == "--particles")
+                options.nb_particles = to_unsigned(value);
+            else if (option == "--steps")
+                options.steps = to_unsigned(value);
+            else if (option == "--seconds")
+                options.seconds = to_float(value);
+            else if (option == "--seed")
+                options.seed = to_unsigned(value);
+            else if (option == "--frames")
+                options.frames = value;
+            else if (option == "--output")
+                options.output = value;
+            else if (option == "--frame-interval")
+                options.frame_interval = to_unsigned(value);
+            else if (option == "--width")
+                options.width = to_unsigned(value);
+            else if (option == "--height")
+                options.height = to_unsigned(value);
+            else
+                return false;
         }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
 
-        // Draw
-        window.clear();
-
-        window.draw(array, &particle_texture);
-        window.draw(world_box);
-        // window.draw(sim.get_quadtree());
-        // window.draw(vertices_drawn);
+    // Without limit, run a fixed number of steps
+    if (options.steps == 0 && options.seconds <= 0.0f)
+        options.steps = 1000;
 
-        window.display();
-    }
+    const bool valid_engine = options.engine == "main" || options.engine == "fluid" || options.engine == "sph" || options.engine == "pbf";
+    const bool valid_frames = options.frames == "none" || options.frames == "ppm" || options.frames == "png" || options.frames == "raw";
 
-    return 0;
+    return valid_engine && valid_frames && options.nb_particles > 0 && options.seconds >= 0.0f &&
+           options.frame_interval > 0 && options.width > 0 && options.height > 0;
 }
 
-// Create particle vertex array
-sf::VertexArray create_particle_array(const std::vector<std::shared_ptr<Particle>> &particles,
-                                      const sf::Texture &texture,
-                                      const sf::RenderWindow &window)
+// Run the physics without window or OpenGL context, then print throughput statistics
+int run_headless(const HeadlessOptions &options)
 {
-    const size_t nb_particles = particles.size();
-    sf::VertexArray array(sf::Triangles, 6 * nb_particles);
-
-    // Current view, calculate view bounds (visible area)
-    const sf::Vector2f &view_center = window.getView().getCenter();
-    const sf::Vector2f &view_size = window.getView().getSize();
-    const sf::FloatRect view_bounds(view_center - view_size / 2.0f, view_size);
-
-    // Compute texture coords
-    const float width = texture.getSize().x;
-    const float height = texture.getSize().y;
-    const sf::Vector2f tex_coords[4] = {
-        {0.0f, 0.0f},
-        {0.0f, height},
-        {width, height},
-        {width, 0.0}};
-
-    // Variable for possible future resizing
-    size_t vertex_count = 0;
-
-// Parkour all particles and add only if visible
-#pragma omp parallel for
-    for (size_t i = 0; i < nb_particles; ++i)
+    Params params = conf::GENERATOR_PARAMS;
+    params.nb_particles = options.nb_particles;
+    ParticleStore particles = generate_random_particles(params, options.seed);
+
+    const Box world_box{conf::WORLD_CENTER, {conf::XMAX, conf::YMAX}};
+
+    // Raw frames go to stdout, so messages go to stderr
+    const bool raw_frames = options.frames == "raw";
+    std::ostream &log = raw_frames ? std::cerr : std::cout;
+#ifdef _WIN32
+    if (raw_frames)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    log << "Pair kernels : " << get_pair_kernels().name << "\n";
+    log << "Engine : " << options.engine << ", " << particles.size() << " particles, seed " << options.seed << "\n";
+
+    // Frames show the same view as the window
+    std::unique_ptr<SoftwareRenderer> frame_renderer;
+    if (options.frames != "none")
+        frame_renderer = std::make_unique<SoftwareRenderer>(options.width, options.height, conf::WORLD_CENTER, 2.0f * world_box.get_half_dimension());
+
+    // Main loop physics, or one of the Simulation engines, each update is one step of DT
+    std::unique_ptr<Physics> physics;
+    std::unique_ptr<Simulation> sim;
+    if (options.engine == "fluid")
+        sim = std::make_unique<SimulationFluid>(particles, world_box, conf::DT, conf::SUBSTEPS);
+    else if (options.engine == "sph")
+        sim = std::make_unique<SimulationSPH>(particles, world_box, conf::DT, 1);
+    else if (options.engine == "pbf")
+        sim = std::make_unique<SimulationPBF>(particles, world_box, conf::DT, 1);
+    else
+        physics = std::make_unique<Physics>(world_box, particles);
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    unsigned steps = 0;
+    double elapsed = 0.0;
+    double min_step = std::numeric_limits<double>::infinity();
+    double max_step = 0.0;
+    unsigned frames = 0;
+    double frame_time = 0.0;
+    while ((options.steps == 0 || steps < options.steps) && (options.seconds <= 0.0f || elapsed < options.seconds))
     {
-        const sf::Vector2f &position = particles[i]->get_position();
-        const sf::Color &color = particles[i]->get_color();
-        const float radius = particles[i]->get_radius();
-        const sf::FloatRect particle_box(position - sf::Vector2f{radius, radius}, {2.0f * radius, 2.0f * radius});
+        const Clock::time_point step_start = Clock::now();
 
-        if (!view_bounds.intersects(particle_box))
-            continue;
+        if (sim)
+            sim->update();
+        else
+            simulate_step(particles, *physics, conf::WORLD_CENTER, 0.0f);
 
-        const size_t idx = __sync_fetch_and_add(&vertex_count, 6);
+        const Clock::time_point step_end = Clock::now();
+        const double step_time = std::chrono::duration<double>(step_end - step_start).count();
+        min_step = std::min(min_step, step_time);
+        max_step = std::max(max_step, step_time);
+        ++steps;
 
-        // Define vertices position
-        array[idx + 0].position = {position.x - radius, position.y - radius}; // Bottom left
-        array[idx + 1].position = {position.x - radius, position.y + radius}; // Top left
-        array[idx + 2].position = {position.x + radius, position.y + radius}; // Top right
+        // Frame export, timed apart from the physics
+        if (frame_renderer && steps % options.frame_interval == 0)
+        {
+            frame_renderer->render(sim ? sim->get_particles() : particles);
 
-        array[idx + 3].position = {position.x - radius, position.y - radius}; // Bottom left
-        array[idx + 4].position = {position.x + radius, position.y + radius}; // Top right
-        array[idx + 5].position = {position.x + radius, position.y - radius}; // Bottom right
+            bool written;
+            if (raw_frames)
+                written = frame_renderer->write_raw(stdout);
+            else
+            {
+                std::string index = std::to_string(frames);
+                index.insert(0, index.size() < 6 ? 6 - index.size() : 0, '0');
+                const std::string path = options.output + index + "." + options.frames;
+                written = options.frames == "png" ? frame_renderer->save_png(path) : frame_renderer->save_ppm(path);
+            }
 
-        // Define texture coords
-        array[idx + 0].texCoords = tex_coords[0];
-        array[idx + 1].texCoords = tex_coords[1];
-        array[idx + 2].texCoords = tex_coords[2];
+            if (!written)
+            {
+                log << "Could not write frame " << frames << "\n";
+                return 1;
+            }
 
-        array[idx + 3].texCoords = tex_coords[0];
-        array[idx + 4].texCoords = tex_coords[2];
-        array[idx + 5].texCoords = tex_coords[3];
+            frame_time += std::chrono::duration<double>(Clock::now() - step_end).count();
+            ++frames;
+        }
 
-        // Define color
-        for (size_t j = 0; j < 6; ++j)
-            array[idx + j].color = color;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
     }
 
-    // Resize array
-    array.resize(vertex_count);
+    // Throughput statistics
+    const double physics_time = elapsed - frame_time;
+    const double simulated = steps * static_cast<double>(conf::DT);
+    log << "Steps : " << steps << " in " << elapsed << " s (" << simulated << " s simulated, "
+        << simulated / elapsed << "x real time)\n";
+    log << "Step time : " << 1000.0 * physics_time / steps << " ms avg, "
+        << 1000.0 * min_step << " ms min, " << 1000.0 * max_step << " ms max\n";
+    log << "Throughput : " << steps / physics_time << " steps/s, "
+        << steps * static_cast<double>(options.nb_particles) / physics_time / 1e6 << " M particle steps/s\n";
+    if (frames > 0)
+        log << "Frames : " << frames << " " << options.width << "x" << options.height << " " << options.frames
+            << ", " << 1000.0 * frame_time / frames << " ms avg\n";
 
-    return array;
+    return 0;
 }
 
 // Generate random particles with the given parameters and the given seed
-std::vector<std::shared_ptr<Particle>> generate_random_particles(const Params &params, const unsigned seed)
+ParticleStore generate_random_particles(const Params &params, const unsigned seed)
 {
-    // Output array
-    std::vector<std::shared_ptr<Particle>> particles(params.nb_particles);
+    // Output store
+    ParticleStore particles;
+    particles.reserve(params.nb_particles);
 
     // Randomizer with given seed
     std::mt19937 gen(seed);
@@ -292,37 +570,126 @@ std::vector<std::shared_ptr<Particle>> generate_random_particles(const Params &p
         const sf::Vector2f acc{0.0f, 0.0f};
 
         // Create a particle
-        auto particle = std::make_shared<Particle>(radius * std::sqrt(m), sf::Color::White, m, pos, vel, acc);
-        particles[i] = particle;
+        particles.add(radius * std::sqrt(m), sf::Color::White, m, pos, vel, acc);
     }
 
     return particles;
 }
 
 // Update particles
-void update(std::vector<std::shared_ptr<Particle>> &particles, const size_t start, const size_t end, const float dt, const Boundary &boundary, const bool enable_omp)
+void update(ParticleStore &particles, const uint32_t start, const uint32_t end, const float dt, const Boundary &boundary, const bool enable_omp)
 {
     if (enable_omp)
     {
 #pragma omp parallel for
-        for (size_t i = start; i < end; ++i)
+        for (uint32_t i = start; i < end; ++i)
         {
-            auto &p = particles[i];
-            p->handle_boundaries(boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
-            p->update(dt);
+            particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+            particles.update(i, dt);
         }
     }
     else
     {
-        for (size_t i = start; i < end; ++i)
+        for (uint32_t i = start; i < end; ++i)
         {
-            auto &p = particles[i];
-            p->handle_boundaries(boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
-            p->update(dt);
+            particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+            particles.update(i, dt);
         }
     }
 }
 
+// Apply mouse attraction or repulsion to particles near the mouse
+template <typename Tree>
+void apply_mouse_force(ParticleStore &particles, const Tree &tree, const sf::Vector2f &world_pos, const float strength)
+{
+    if (strength == 0.0f)
+        return;
+
+    const Box mouse_box{world_pos, {100.0f, 100.0f}};
+    tree.for_each_in(mouse_box, [&](const uint32_t j)
+    {
+        // Sleeping particles would not feel the force
+        particles.wake(j);
+
+        sf::Vector2f axis = world_pos - particles.get_position(j);
+        const float length = std::sqrt((axis.x * axis.x) + (axis.y * axis.y));
+        if (length != 0.0f)
+            axis /= length;
+        particles.apply_force(j, axis * strength);
+    });
+}
+
+// Solve collisions, then apply gravity and update particles
+template <typename Tree>
+void step(ParticleStore &particles, const Tree &tree, const Boundary &boundary, const float dt)
+{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+
+    // Boundary detection, sleeping particles did not move
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        if (!particles.is_asleep(i))
+            particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+    }
+
+    // Collision detection, Jacobi style: every particle reads the current positions
+    // and only writes its own corrected position to the next buffer, so no lock is needed
+    // Pairs are summed by the vector kernels picked for this CPU
+    // Sleeping particles are not queried, awake ones collide with them as with fixed obstacles
+    const PairKernels &kernels = get_pair_kernels();
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        if (particles.is_asleep(i))
+        {
+            particles.set_next_position(i, particles.get_position(i));
+            continue;
+        }
+
+        const float half_size = 2 * particles.get_radius(i);
+        const Box p_box{particles.get_position(i), sf::Vector2f{half_size, half_size}};
+
+        // Each thread reuses its own neighbor buffer, so queries do not allocate
+        thread_local std::vector<uint32_t> neighbors;
+        neighbors.clear();
+        tree.query(p_box, neighbors);
+
+        const sf::Vector2f correction = kernels.collision(particles, i, neighbors, half_size);
+        particles.set_next_position(i, particles.get_position(i) + correction);
+
+        // A moving particle wakes the sleeping particles it touches, WAKE_VELOCITY is a distance per DT
+        const sf::Vector2f velocity = particles.get_velocity(i) * (conf::DT / dt);
+        if (velocity.x * velocity.x + velocity.y * velocity.y < conf::WAKE_VELOCITY * conf::WAKE_VELOCITY)
+            continue;
+
+        for (const uint32_t j : neighbors)
+        {
+            if (particles.is_asleep(j) && particles.is_colliding(i, j))
+                particles.request_wake(j);
+        }
+    }
+    particles.swap_positions();
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        // Sleeping particles stay in place, unless a neighbor woke them during this step
+        particles.update_sleep(i, dt);
+        if (particles.is_asleep(i))
+        {
+            particles.reset_acceleration(i);
+            continue;
+        }
+
+        // Gravity
+        particles.apply_force(i, {0.0f, 50.f});
+
+        // Physics update
+        particles.update(i, dt);
+    }
+}
+
 // QuadTree initial Box
 // const Box box{conf::WORLD_CENTER, {conf::WORLD_WIDTH / 2.0f, conf::WORLD_HEIGHT / (2.0f * conf::ASPECT_RATIO)}};
 
@@ -0,0 +1,14 @@
+#include "neighbor_list.hpp"
+
+// Remove every list
+void NeighborList::clear()
+{
+    offsets.assign(1, 0);
+    neighbors.clear();
+}
+
+// Total number of neighbors stored
+size_t NeighborList::count() const
+{
+    return neighbors.size();
+}
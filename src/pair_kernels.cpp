@@ -0,0 +1,384 @@
+#include "pair_kernels.hpp"
+
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PAIR_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// Pressure force applied to particle i by the candidates in its query box, one pair at a time
+static sf::Vector2f pressure_scalar(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size)
+{
+    const float *x = particles.get_x();
+    const float *y = particles.get_y();
+
+    const float xi = x[i];
+    const float yi = y[i];
+    const float xmin = xi - half_size;
+    const float xmax = xi + half_size;
+    const float ymin = yi - half_size;
+    const float ymax = yi + half_size;
+
+    sf::Vector2f force{0.0f, 0.0f};
+    for (const uint32_t j : candidates)
+    {
+        if (j == i || !(xmin <= x[j] && x[j] < xmax && ymin <= y[j] && y[j] < ymax))
+            continue;
+
+        const float dx = xi - x[j];
+        const float dy = yi - y[j];
+        const float dist = std::sqrt(dx * dx + dy * dy);
+        if (dist != 0)
+            force += sf::Vector2f{dx / (dist * dist), dy / (dist * dist)};
+    }
+
+    return force;
+}
+
+// Displacement of particle i that solves its collisions with the candidates in its query box, one pair at a time
+static sf::Vector2f collision_scalar(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size)
+{
+    const float *x = particles.get_x();
+    const float *y = particles.get_y();
+    const float *radius = particles.get_radii();
+    const float *mass = particles.get_masses();
+
+    const float xi = x[i];
+    const float yi = y[i];
+    const float xmin = xi - half_size;
+    const float xmax = xi + half_size;
+    const float ymin = yi - half_size;
+    const float ymax = yi + half_size;
+
+    sf::Vector2f correction{0.0f, 0.0f};
+    for (const uint32_t j : candidates)
+    {
+        if (j == i || !(xmin <= x[j] && x[j] < xmax && ymin <= y[j] && y[j] < ymax))
+            continue;
+
+        const float dx = xi - x[j];
+        const float dy = yi - y[j];
+        const float threshold = radius[i] + radius[j];
+        const float dist2 = dx * dx + dy * dy;
+        if (dist2 > threshold * threshold)
+            continue;
+
+        // Particle i only moves by its share of the overlap
+        const float dist = std::sqrt(dist2);
+        const float overlap = threshold - dist;
+        if (overlap <= 0 || dist == 0)
+            continue;
+
+        const float ratio_other = mass[j] / (mass[i] + mass[j]);
+        const float factor = overlap * ratio_other * conf::PARTICLE_DAMPING / dist;
+        correction += sf::Vector2f{dx * factor, dy * factor};
+    }
+
+    return correction;
+}
+
+#ifdef PAIR_KERNELS_X86
+
+// Sum of the 8 lanes
+__attribute__((target("avx2")))
+static float sum_avx2(const __m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+    return _mm_cvtss_f32(s);
+}
+
+// Load the next 8 candidates, lanes past the end are set to i so that they are masked as the self pair
+__attribute__((target("avx2")))
+static __m256i load_candidates_avx2(const uint32_t *candidates, const size_t remaining, const __m256i self)
+{
+    if (remaining >= 8)
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(candidates));
+
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(remaining)), lanes);
+    const __m256i loaded = _mm256_maskload_epi32(reinterpret_cast<const int *>(candidates), valid);
+    return _mm256_blendv_epi8(self, loaded, valid);
+}
+
+// Lanes whose candidate is not i and is in the query box of i
+__attribute__((target("avx2")))
+static __m256 box_mask_avx2(const __m256i idx, const __m256i self, const __m256 xj, const __m256 yj,
+                            const __m256 xmin, const __m256 xmax, const __m256 ymin, const __m256 ymax)
+{
+    __m256 mask = _mm256_and_ps(_mm256_cmp_ps(xmin, xj, _CMP_LE_OQ), _mm256_cmp_ps(xj, xmax, _CMP_LT_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(ymin, yj, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(yj, ymax, _CMP_LT_OQ));
+    return _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(idx, self)), mask);
+}
+
+// Pressure force, 8 candidates at a time
+__attribute__((target("avx2")))
+static sf::Vector2f pressure_avx2(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size)
+{
+    const float *x = particles.get_x();
+    const float *y = particles.get_y();
+
+    const __m256i self = _mm256_set1_epi32(static_cast<int>(i));
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 xi = _mm256_set1_ps(x[i]);
+    const __m256 yi = _mm256_set1_ps(y[i]);
+    const __m256 xmin = _mm256_set1_ps(x[i] - half_size);
+    const __m256 xmax = _mm256_set1_ps(x[i] + half_size);
+    const __m256 ymin = _mm256_set1_ps(y[i] - half_size);
+    const __m256 ymax = _mm256_set1_ps(y[i] + half_size);
+
+    __m256 fx = zero;
+    __m256 fy = zero;
+    for (size_t k = 0; k < candidates.size(); k += 8)
+    {
+        const __m256i idx = load_candidates_avx2(candidates.data() + k, candidates.size() - k, self);
+        const __m256 xj = _mm256_i32gather_ps(x, idx, 4);
+        const __m256 yj = _mm256_i32gather_ps(y, idx, 4);
+
+        const __m256 dx = _mm256_sub_ps(xi, xj);
+        const __m256 dy = _mm256_sub_ps(yi, yj);
+        const __m256 dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        const __m256 dist2 = _mm256_mul_ps(dist, dist);
+
+        // Masked lanes may hold inf or nan, they are cleared before the sum
+        __m256 mask = box_mask_avx2(idx, self, xj, yj, xmin, xmax, ymin, ymax);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(dist, zero, _CMP_NEQ_OQ));
+        fx = _mm256_add_ps(fx, _mm256_and_ps(mask, _mm256_div_ps(dx, dist2)));
+        fy = _mm256_add_ps(fy, _mm256_and_ps(mask, _mm256_div_ps(dy, dist2)));
+    }
+
+    return {sum_avx2(fx), sum_avx2(fy)};
+}
+
+// Collision correction, 8 candidates at a time
+__attribute__((target("avx2")))
+static sf::Vector2f collision_avx2(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size)
+{
+    const float *x = particles.get_x();
+    const float *y = particles.get_y();
+    const float *radius = particles.get_radii();
+    const float *mass = particles.get_masses();
+
+    const __m256i self = _mm256_set1_epi32(static_cast<int>(i));
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 damping = _mm256_set1_ps(conf::PARTICLE_DAMPING);
+    const __m256 xi = _mm256_set1_ps(x[i]);
+    const __m256 yi = _mm256_set1_ps(y[i]);
+    const __m256 ri = _mm256_set1_ps(radius[i]);
+    const __m256 mi = _mm256_set1_ps(mass[i]);
+    const __m256 xmin = _mm256_set1_ps(x[i] - half_size);
+    const __m256 xmax = _mm256_set1_ps(x[i] + half_size);
+    const __m256 ymin = _mm256_set1_ps(y[i] - half_size);
+    const __m256 ymax = _mm256_set1_ps(y[i] + half_size);
+
+    __m256 cx = zero;
+    __m256 cy = zero;
+    for (size_t k = 0; k < candidates.size(); k += 8)
+    {
+        const __m256i idx = load_candidates_avx2(candidates.data() + k, candidates.size() - k, self);
+        const __m256 xj = _mm256_i32gather_ps(x, idx, 4);
+        const __m256 yj = _mm256_i32gather_ps(y, idx, 4);
+        const __m256 rj = _mm256_i32gather_ps(radius, idx, 4);
+        const __m256 mj = _mm256_i32gather_ps(mass, idx, 4);
+
+        const __m256 dx = _mm256_sub_ps(xi, xj);
+        const __m256 dy = _mm256_sub_ps(yi, yj);
+        const __m256 threshold = _mm256_add_ps(ri, rj);
+        const __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        const __m256 dist = _mm256_sqrt_ps(dist2);
+        const __m256 overlap = _mm256_sub_ps(threshold, dist);
+
+        __m256 mask = box_mask_avx2(idx, self, xj, yj, xmin, xmax, ymin, ymax);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(dist2, _mm256_mul_ps(threshold, threshold), _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(overlap, zero, _CMP_GT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(dist, zero, _CMP_NEQ_OQ));
+
+        // Particle i only moves by its share of the overlap
+        const __m256 ratio_other = _mm256_div_ps(mj, _mm256_add_ps(mi, mj));
+        const __m256 factor = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(overlap, ratio_other), damping), dist);
+        cx = _mm256_add_ps(cx, _mm256_and_ps(mask, _mm256_mul_ps(dx, factor)));
+        cy = _mm256_add_ps(cy, _mm256_and_ps(mask, _mm256_mul_ps(dy, factor)));
+    }
+
+    return {sum_avx2(cx), sum_avx2(cy)};
+}
+
+// Sum of the 16 lanes
+// Lanes are stored and added in order, the reduce intrinsics trip uninitialized warnings in some GCC versions
+__attribute__((target("avx512f")))
+static float sum_avx512(const __m512 v)
+{
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+
+    float sum = 0.0f;
+    for (const float lane : lanes)
+        sum += lane;
+    return sum;
+}
+
+// Lanes that hold a candidate, the tail is handled with a partial mask
+__attribute__((target("avx512f")))
+static __mmask16 valid_mask_avx512(const size_t remaining)
+{
+    return remaining >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << remaining) - 1);
+}
+
+// Lanes whose candidate is in the query box of i
+__attribute__((target("avx512f")))
+static __mmask16 box_mask_avx512(__mmask16 mask, const __m512 xj, const __m512 yj,
+                                 const __m512 xmin, const __m512 xmax, const __m512 ymin, const __m512 ymax)
+{
+    mask = _mm512_mask_cmp_ps_mask(mask, xmin, xj, _CMP_LE_OQ);
+    mask = _mm512_mask_cmp_ps_mask(mask, xj, xmax, _CMP_LT_OQ);
+    mask = _mm512_mask_cmp_ps_mask(mask, ymin, yj, _CMP_LE_OQ);
+    return _mm512_mask_cmp_ps_mask(mask, yj, ymax, _CMP_LT_OQ);
+}
+
+// Pressure force, 16 candidates at a time
+__attribute__((target("avx512f")))
+static sf::Vector2f pressure_avx512(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size)
+{
+    const float *x = particles.get_x();
+    const float *y = particles.get_y();
+
+    const __m512i self = _mm512_set1_epi32(static_cast<int>(i));
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 xi = _mm512_set1_ps(x[i]);
+    const __m512 yi = _mm512_set1_ps(y[i]);
+    const __m512 xmin = _mm512_set1_ps(x[i] - half_size);
+    const __m512 xmax = _mm512_set1_ps(x[i] + half_size);
+    const __m512 ymin = _mm512_set1_ps(y[i] - half_size);
+    const __m512 ymax = _mm512_set1_ps(y[i] + half_size);
+
+    __m512 fx = zero;
+    __m512 fy = zero;
+    for (size_t k = 0; k < candidates.size(); k += 16)
+    {
+        // Lanes past the end and the self pair are neither loaded nor summed
+        const __mmask16 valid = valid_mask_avx512(candidates.size() - k);
+        const __m512i idx = _mm512_maskz_loadu_epi32(valid, candidates.data() + k);
+        __mmask16 mask = _mm512_mask_cmpneq_epi32_mask(valid, idx, self);
+
+        const __m512 xj = _mm512_mask_i32gather_ps(zero, mask, idx, x, 4);
+        const __m512 yj = _mm512_mask_i32gather_ps(zero, mask, idx, y, 4);
+
+        const __m512 dx = _mm512_sub_ps(xi, xj);
+        const __m512 dy = _mm512_sub_ps(yi, yj);
+        const __m512 dist = _mm512_maskz_sqrt_ps(mask, _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)));
+        const __m512 dist2 = _mm512_mul_ps(dist, dist);
+
+        mask = box_mask_avx512(mask, xj, yj, xmin, xmax, ymin, ymax);
+        mask = _mm512_mask_cmp_ps_mask(mask, dist, zero, _CMP_NEQ_OQ);
+        fx = _mm512_mask_add_ps(fx, mask, fx, _mm512_maskz_div_ps(mask, dx, dist2));
+        fy = _mm512_mask_add_ps(fy, mask, fy, _mm512_maskz_div_ps(mask, dy, dist2));
+    }
+
+    return {sum_avx512(fx), sum_avx512(fy)};
+}
+
+// Collision correction, 16 candidates at a time
+__attribute__((target("avx512f")))
+static sf::Vector2f collision_avx512(const ParticleStore &particles, const uint32_t i, std::span<const uint32_t> candidates, const float half_size)
+{
+    const float *x = particles.get_x();
+    const float *y = particles.get_y();
+    const float *radius = particles.get_radii();
+    const float *mass = particles.get_masses();
+
+    const __m512i self = _mm512_set1_epi32(static_cast<int>(i));
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 damping = _mm512_set1_ps(conf::PARTICLE_DAMPING);
+    const __m512 xi = _mm512_set1_ps(x[i]);
+    const __m512 yi = _mm512_set1_ps(y[i]);
+    const __m512 ri = _mm512_set1_ps(radius[i]);
+    const __m512 mi = _mm512_set1_ps(mass[i]);
+    const __m512 xmin = _mm512_set1_ps(x[i] - half_size);
+    const __m512 xmax = _mm512_set1_ps(x[i] + half_size);
+    const __m512 ymin = _mm512_set1_ps(y[i] - half_size);
+    const __m512 ymax = _mm512_set1_ps(y[i] + half_size);
+
+    __m512 cx = zero;
+    __m512 cy = zero;
+    for (size_t k = 0; k < candidates.size(); k += 16)
+    {
+        // Lanes past the end and the self pair are neither loaded nor summed
+        const __mmask16 valid = valid_mask_avx512(candidates.size() - k);
+        const __m512i idx = _mm512_maskz_loadu_epi32(valid, candidates.data() + k);
+        __mmask16 mask = _mm512_mask_cmpneq_epi32_mask(valid, idx, self);
+
+        const __m512 xj = _mm512_mask_i32gather_ps(zero, mask, idx, x, 4);
+        const __m512 yj = _mm512_mask_i32gather_ps(zero, mask, idx, y, 4);
+        mask = box_mask_avx512(mask, xj, yj, xmin, xmax, ymin, ymax);
+
+        const __m512 rj = _mm512_mask_i32gather_ps(zero, mask, idx, radius, 4);
+        const __m512 mj = _mm512_mask_i32gather_ps(mi, mask, idx, mass, 4);
+
+        const __m512 dx = _mm512_sub_ps(xi, xj);
+        const __m512 dy = _mm512_sub_ps(yi, yj);
+        const __m512 threshold = _mm512_add_ps(ri, rj);
+        const __m512 dist2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        const __m512 dist = _mm512_maskz_sqrt_ps(mask, dist2);
+        const __m512 overlap = _mm512_sub_ps(threshold, dist);
+
+        mask = _mm512_mask_cmp_ps_mask(mask, dist2, _mm512_mul_ps(threshold, threshold), _CMP_LE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, overlap, zero, _CMP_GT_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, dist, zero, _CMP_NEQ_OQ);
+
+        // Particle i only moves by its share of the overlap
+        const __m512 ratio_other = _mm512_div_ps(mj, _mm512_add_ps(mi, mj));
+        const __m512 factor = _mm512_maskz_div_ps(mask, _mm512_mul_ps(_mm512_mul_ps(overlap, ratio_other), damping), dist);
+        cx = _mm512_mask_add_ps(cx, mask, cx, _mm512_mul_ps(dx, factor));
+        cy = _mm512_mask_add_ps(cy, mask, cy, _mm512_mul_ps(dy, factor));
+    }
+
+    return {sum_avx512(cx), sum_avx512(cy)};
+}
+
+#endif
+
+static const PairKernels scalar_kernels{PairKernelIsa::Scalar, "scalar", pressure_scalar, collision_scalar};
+
+#ifdef PAIR_KERNELS_X86
+static const PairKernels avx2_kernels{PairKernelIsa::AVX2, "avx2", pressure_avx2, collision_avx2};
+static const PairKernels avx512_kernels{PairKernelIsa::AVX512, "avx512", pressure_avx512, collision_avx512};
+#endif
+
+// Check if the CPU can run the kernels of the given instruction set
+bool pair_kernels_supported(const PairKernelIsa isa)
+{
+#ifdef PAIR_KERNELS_X86
+    __builtin_cpu_init();
+    if (isa == PairKernelIsa::AVX2)
+        return __builtin_cpu_supports("avx2");
+    if (isa == PairKernelIsa::AVX512)
+        return __builtin_cpu_supports("avx512f");
+#endif
+
+    return isa == PairKernelIsa::Scalar;
+}
+
+// Kernels of the given instruction set, scalar ones if it is not supported
+const PairKernels &get_pair_kernels(const PairKernelIsa isa)
+{
+#ifdef PAIR_KERNELS_X86
+    if (isa == PairKernelIsa::AVX512 && pair_kernels_supported(isa))
+        return avx512_kernels;
+    if (isa == PairKernelIsa::AVX2 && pair_kernels_supported(isa))
+        return avx2_kernels;
+#endif
+
+    return scalar_kernels;
+}
+
+// Fastest kernels supported by the CPU, detected on the first call
+const PairKernels &get_pair_kernels()
+{
+    static const PairKernels &kernels = pair_kernels_supported(PairKernelIsa::AVX512) ? get_pair_kernels(PairKernelIsa::AVX512)
+                                      : pair_kernels_supported(PairKernelIsa::AVX2)   ? get_pair_kernels(PairKernelIsa::AVX2)
+                                                                                       : get_pair_kernels(PairKernelIsa::Scalar);
+    return kernels;
+}
@@ -0,0 +1,158 @@
+#include "particle_renderer.hpp"
+
+// Constructor
+ParticleRenderer::ParticleRenderer(const sf::Texture &texture,
+                                   const size_t capacity,
+                                   const bool use_vertex_buffer) : texture(&texture),
+                                                                   buffer(sf::Triangles, sf::VertexBuffer::Stream),
+                                                                   use_buffer(use_vertex_buffer && sf::VertexBuffer::isAvailable())
+{
+    reserve(capacity);
+}
+
+// Grow storage to hold the quads of the given number of particles
+void ParticleRenderer::reserve(const size_t capacity)
+{
+    const size_t old_size = vertices.size();
+    if (6 * capacity <= old_size)
+        return;
+
+    vertices.resize(6 * capacity);
+
+    // Texture coords are the same for every quad
+    const float width = static_cast<float>(texture->getSize().x);
+    const float height = static_cast<float>(texture->getSize().y);
+    const sf::Vector2f tex_coords[6] = {
+        {0.0f, 0.0f},
+        {0.0f, height},
+        {width, height},
+        {0.0f, 0.0f},
+        {width, height},
+        {width, 0.0f}};
+
+    for (size_t k = old_size; k < vertices.size(); ++k)
+        vertices[k].texCoords = tex_coords[k % 6];
+
+    // The buffer keeps its content up to the visible prefix, which is written again on the next update
+    if (use_buffer && !buffer.create(vertices.size()))
+        use_buffer = false;
+}
+
+// Write the quads of the visible particles
+void ParticleRenderer::update(const ParticleSnapshot &particles, const sf::View &view, const float alpha)
+{
+    const size_t nb_particles = particles.size();
+    reserve(nb_particles);
+
+    // Current view, calculate view bounds (visible area)
+    const sf::Vector2f &view_center = view.getCenter();
+    const sf::Vector2f &view_size = view.getSize();
+    const sf::FloatRect view_bounds(view_center - view_size / 2.0f, view_size);
+
+    // Stream over the particle arrays
+    const float *xs = particles.x.data();
+    const float *ys = particles.y.data();
+    const float *xs_previous = particles.x_previous.data();
+    const float *ys_previous = particles.y_previous.data();
+    const float *radii = particles.radius.data();
+    const sf::Color *colors = particles.color.data();
+
+    // Check if a particle is visible, and where it is drawn
+    const auto visible = [&](const size_t i, sf::Vector2f &position)
+    {
+        position = {xs_previous[i] + alpha * (xs[i] - xs_previous[i]),
+                    ys_previous[i] + alpha * (ys[i] - ys_previous[i])};
+        const float radius = radii[i];
+        const sf::FloatRect particle_box(position - sf::Vector2f{radius, radius}, {2.0f * radius, 2.0f * radius});
+
+        return view_bounds.intersects(particle_box);
+    };
+
+    // Visible particles of each block are counted, then written in their own range of quads
+    const size_t nb_blocks = (nb_particles + block_size - 1) / block_size;
+    block_offsets.resize(nb_blocks);
+
+#pragma omp parallel for
+    for (size_t block = 0; block < nb_blocks; ++block)
+    {
+        const size_t end = std::min(nb_particles, (block + 1) * block_size);
+        size_t count = 0;
+        for (size_t i = block * block_size; i < end; ++i)
+        {
+            sf::Vector2f position;
+            count += visible(i, position);
+        }
+        block_offsets[block] = count;
+    }
+
+    // Exclusive scan, blocks write one after the other in storage order
+    size_t count = 0;
+    for (size_t &offset : block_offsets)
+    {
+        const size_t c = offset;
+        offset = count;
+        count += c;
+    }
+
+#pragma omp parallel for
+    for (size_t block = 0; block < nb_blocks; ++block)
+    {
+        const size_t end = std::min(nb_particles, (block + 1) * block_size);
+        sf::Vertex *quad = &vertices[6 * block_offsets[block]];
+        for (size_t i = block * block_size; i < end; ++i)
+        {
+            sf::Vector2f position;
+            if (!visible(i, position))
+                continue;
+
+            const sf::Color color = colors[i];
+            const float radius = radii[i];
+
+            // Define vertices position
+            quad[0].position = {position.x - radius, position.y - radius}; // Bottom left
+            quad[1].position = {position.x - radius, position.y + radius}; // Top left
+            quad[2].position = {position.x + radius, position.y + radius}; // Top right
+
+            quad[3].position = {position.x - radius, position.y - radius}; // Bottom left
+            quad[4].position = {position.x + radius, position.y + radius}; // Top right
+            quad[5].position = {position.x + radius, position.y - radius}; // Bottom right
+
+            // Define color
+            for (size_t j = 0; j < 6; ++j)
+                quad[j].color = color;
+
+            quad += 6;
+        }
+    }
+
+    vertex_count = 6 * count;
+
+    // Only the visible prefix is uploaded
+    if (use_buffer && vertex_count > 0)
+        buffer.update(vertices.data(), vertex_count, 0);
+}
+
+// Number of vertices drawn
+size_t ParticleRenderer::get_vertex_count() const
+{
+    return vertex_count;
+}
+
+// Check if vertices are streamed to a vertex buffer
+bool ParticleRenderer::uses_vertex_buffer() const
+{
+    return use_buffer;
+}
+
+// Draw the visible quads
+void ParticleRenderer::draw(sf::RenderTarget &target, sf::RenderStates states) const
+{
+    if (vertex_count == 0)
+        return;
+
+    states.texture = texture;
+    if (use_buffer)
+        target.draw(buffer, 0, vertex_count, states);
+    else
+        target.draw(vertices.data(), vertex_count, sf::Triangles, states);
+}
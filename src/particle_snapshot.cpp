@@ -0,0 +1,22 @@
+#include "particle_snapshot.hpp"
+
+// Copy the particles
+void ParticleSnapshot::capture(const ParticleStore &particles)
+{
+    const size_t n = particles.size();
+
+    x.assign(particles.get_x(), particles.get_x() + n);
+    y.assign(particles.get_y(), particles.get_y() + n);
+    x_previous.assign(particles.get_x_previous(), particles.get_x_previous() + n);
+    y_previous.assign(particles.get_y_previous(), particles.get_y_previous() + n);
+    radius.assign(particles.get_radii(), particles.get_radii() + n);
+    color.assign(particles.get_colors(), particles.get_colors() + n);
+
+    time = std::chrono::steady_clock::now();
+}
+
+// Number of particles
+size_t ParticleSnapshot::size() const
+{
+    return x.size();
+}
@@ -0,0 +1,253 @@
+#include "particle_store.hpp"
+
+#include <limits>
+
+// Gather values in the given order, tmp receives the previous values so its memory is reused
+template <typename V>
+static void permute(std::vector<V> &values, const std::vector<uint32_t> &order, std::vector<V> &tmp)
+{
+    const size_t n = order.size();
+    tmp.resize(n);
+
+#pragma omp parallel for
+    for (size_t k = 0; k < n; ++k)
+        tmp[k] = values[order[k]];
+
+    values.swap(tmp);
+}
+
+// Reserve memory for the given number of particles
+void ParticleStore::reserve(const size_t capacity)
+{
+    x.reserve(capacity);
+    y.reserve(capacity);
+    x_old.reserve(capacity);
+    y_old.reserve(capacity);
+    x_next.reserve(capacity);
+    y_next.reserve(capacity);
+    x_previous.reserve(capacity);
+    y_previous.reserve(capacity);
+    ax.reserve(capacity);
+    ay.reserve(capacity);
+    mass.reserve(capacity);
+    still_steps.reserve(capacity);
+    x_still.reserve(capacity);
+    y_still.reserve(capacity);
+    wake_requests.reserve(capacity);
+    radius.reserve(capacity);
+    color.reserve(capacity);
+    handles.reserve(capacity);
+    indices.reserve(capacity);
+}
+
+// Add a particle, return its index
+uint32_t ParticleStore::add(const float radius,
+                            const sf::Color &color,
+                            const float mass,
+                            const sf::Vector2f &position,
+                            const sf::Vector2f &velocity,
+                            const sf::Vector2f &acceleration)
+{
+    const uint32_t i = static_cast<uint32_t>(size());
+
+    x.push_back(position.x);
+    y.push_back(position.y);
+    x_old.push_back(position.x - velocity.x);
+    y_old.push_back(position.y - velocity.y);
+    x_next.push_back(position.x);
+    y_next.push_back(position.y);
+    x_previous.push_back(position.x);
+    y_previous.push_back(position.y);
+    ax.push_back(acceleration.x);
+    ay.push_back(acceleration.y);
+    this->mass.push_back(mass);
+    still_steps.push_back(0);
+    x_still.push_back(position.x);
+    y_still.push_back(position.y);
+    wake_requests.push_back(0);
+    this->radius.push_back(radius);
+    this->color.push_back(color);
+    handles.push_back(i);
+    indices.push_back(i);
+
+    return i;
+}
+
+// Handle boundaries
+void ParticleStore::handle_boundaries(const uint32_t i, const float xmin, const float xmax, const float ymin, const float ymax)
+{
+    const float r = radius[i];
+
+    // Left boundary
+    if (x[i] - r < xmin)
+    {
+        const float temp = x[i];
+        x[i] = r + xmin;
+        x_old[i] = temp + (x[i] - x_old[i]) * conf::WALL_DAMPING;
+    }
+
+    // Right boundary
+    else if (x[i] + r > xmax)
+    {
+        const float temp = x[i];
+        x[i] = xmax - r;
+        x_old[i] = temp + (x[i] - x_old[i]) * conf::WALL_DAMPING;
+    }
+
+    // Top boundary
+    if (y[i] - r < ymin)
+    {
+        const float temp = y[i];
+        y[i] = r + ymin;
+        y_old[i] = temp + (y[i] - y_old[i]) * conf::WALL_DAMPING;
+    }
+
+    // Bottom boundary
+    else if (y[i] + r > ymax)
+    {
+        const float temp = y[i];
+        y[i] = ymax - r;
+        y_old[i] = temp + (y[i] - y_old[i]) * conf::WALL_DAMPING;
+    }
+}
+
+// Move particle order[k] to index k, for every k
+void ParticleStore::reorder(const std::vector<uint32_t> &order)
+{
+    permute(x, order, float_scratch);
+    permute(y, order, float_scratch);
+    permute(x_old, order, float_scratch);
+    permute(y_old, order, float_scratch);
+    permute(x_next, order, float_scratch);
+    permute(y_next, order, float_scratch);
+    permute(x_previous, order, float_scratch);
+    permute(y_previous, order, float_scratch);
+    permute(ax, order, float_scratch);
+    permute(ay, order, float_scratch);
+    permute(mass, order, float_scratch);
+    permute(radius, order, float_scratch);
+    permute(x_still, order, float_scratch);
+    permute(y_still, order, float_scratch);
+    if (x_ref.size() == order.size())
+    {
+        permute(x_ref, order, float_scratch);
+        permute(y_ref, order, float_scratch);
+    }
+    permute(color, order, color_scratch);
+    permute(handles, order, handle_scratch);
+    permute(still_steps, order, handle_scratch);
+    permute(wake_requests, order, flag_scratch);
+
+    // Follow every handle to its new index
+    const uint32_t n = static_cast<uint32_t>(handles.size());
+#pragma omp parallel for
+    for (uint32_t i = 0; i < n; ++i)
+        indices[handles[i]] = i;
+}
+
+// Remember current positions, to measure how far particles move from them
+void ParticleStore::save_reference_positions()
+{
+    x_ref = x;
+    y_ref = y;
+}
+
+// Largest distance travelled by a particle since the last save_reference_positions
+float ParticleStore::max_displacement() const
+{
+    if (x_ref.size() != x.size())
+        return std::numeric_limits<float>::infinity();
+
+    const uint32_t n = static_cast<uint32_t>(x.size());
+    float max_dist2 = 0.0f;
+
+#pragma omp parallel for reduction(max : max_dist2)
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        const float dx = x[i] - x_ref[i];
+        const float dy = y[i] - y_ref[i];
+        max_dist2 = std::max(max_dist2, dx * dx + dy * dy);
+    }
+
+    return std::sqrt(max_dist2);
+}
+
+// Largest velocity of a particle, as a distance travelled during the last step
+float ParticleStore::max_velocity() const
+{
+    const uint32_t n = static_cast<uint32_t>(x.size());
+    float max_v2 = 0.0f;
+
+#pragma omp parallel for reduction(max : max_v2)
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        const float vx = x[i] - x_old[i];
+        const float vy = y[i] - y_old[i];
+        max_v2 = std::max(max_v2, vx * vx + vy * vy);
+    }
+
+    return std::sqrt(max_v2);
+}
+
+// Scale every velocity by the given ratio
+void ParticleStore::rescale_velocities(const float ratio)
+{
+    const uint32_t n = static_cast<uint32_t>(x.size());
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        x_old[i] = x[i] - (x[i] - x_old[i]) * ratio;
+        y_old[i] = y[i] - (y[i] - y_old[i]) * ratio;
+    }
+}
+
+// Remember current positions as the state before the next step
+void ParticleStore::save_previous_positions()
+{
+    x_previous = x;
+    y_previous = y;
+}
+
+// Make the next positions current, after every particle has written its own
+void ParticleStore::swap_positions()
+{
+    x.swap(x_next);
+    y.swap(y_next);
+}
+
+// Raw arrays, for kernels that stream over every particle
+const float *ParticleStore::get_x() const
+{
+    return x.data();
+}
+
+const float *ParticleStore::get_y() const
+{
+    return y.data();
+}
+
+const float *ParticleStore::get_x_previous() const
+{
+    return x_previous.data();
+}
+
+const float *ParticleStore::get_y_previous() const
+{
+    return y_previous.data();
+}
+
+const float *ParticleStore::get_radii() const
+{
+    return radius.data();
+}
+
+const float *ParticleStore::get_masses() const
+{
+    return mass.data();
+}
+
+const sf::Color *ParticleStore::get_colors() const
+{
+    return color.data();
+}
@@ -0,0 +1,68 @@
+#include "radix_sort.hpp"
+
+#include <omp.h>
+
+// Sort values by their 32-bit keys, in parallel
+void radix_sort(std::vector<uint32_t> &keys,
+                std::vector<uint32_t> &values,
+                std::vector<uint32_t> &tmp_keys,
+                std::vector<uint32_t> &tmp_values,
+                std::vector<size_t> &thread_counts)
+{
+    constexpr unsigned digit_bits = 8;
+    constexpr unsigned nb_buckets = 1u << digit_bits;
+
+    const size_t n = keys.size();
+    tmp_keys.resize(n);
+    tmp_values.resize(n);
+
+    for (unsigned shift = 0; shift < 32; shift += digit_bits)
+    {
+#pragma omp parallel
+        {
+            const size_t nb_threads = static_cast<size_t>(omp_get_num_threads());
+            const size_t thread = static_cast<size_t>(omp_get_thread_num());
+
+            // Block of keys handled by this thread
+            const size_t begin = n * thread / nb_threads;
+            const size_t end = n * (thread + 1) / nb_threads;
+
+            // Number of keys per bucket counted by each thread, then where each thread writes
+#pragma omp single
+            thread_counts.assign(nb_threads * nb_buckets, 0);
+
+            size_t *counts = thread_counts.data() + thread * nb_buckets;
+            for (size_t i = begin; i < end; ++i)
+                counts[(keys[i] >> shift) & (nb_buckets - 1)]++;
+
+#pragma omp barrier
+
+            // Offsets, bucket by bucket then thread by thread, keeps the sort stable
+#pragma omp single
+            {
+                size_t offset = 0;
+                for (unsigned b = 0; b < nb_buckets; ++b)
+                {
+                    for (size_t t = 0; t < nb_threads; ++t)
+                    {
+                        size_t &count = thread_counts[t * nb_buckets + b];
+                        const size_t c = count;
+                        count = offset;
+                        offset += c;
+                    }
+                }
+            }
+
+            // Scatter
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t dst = counts[(keys[i] >> shift) & (nb_buckets - 1)]++;
+                tmp_keys[dst] = keys[i];
+                tmp_values[dst] = values[i];
+            }
+        }
+
+        keys.swap(tmp_keys);
+        values.swap(tmp_values);
+    }
+}
@@ -1,21 +1,142 @@
 #include "simulation.hpp"
 
 // Constructor
-Simulation::Simulation(const std::vector<std::shared_ptr<Particle>> &particles,
+Simulation::Simulation(const ParticleStore &particles,
                        const Box &world_box,
                        const float dt,
-                       const unsigned nb_substep) : particles(particles), world_box(world_box), qt(world_box), dt(dt), nb_substep(nb_substep) 
+                       const unsigned nb_substep) : particles(particles),
+                                                    world_box(world_box),
+                                                    qt(world_box),
+                                                    spatial_index(conf::SPATIAL_INDEX),
+                                                    lqt(world_box),
+                                                    hg(conf::HASH_GRID_CELL_SIZE),
+                                                    spatial_sort(world_box, conf::REORDER_CELL_SIZE, conf::REORDER_INTERVAL, conf::REORDER_MIN_LOCALITY),
+                                                    dt(dt),
+                                                    nb_substep(nb_substep),
+                                                    adaptive_timestep(conf::ADAPTIVE_TIMESTEP),
+                                                    step_dt(dt / static_cast<float>(std::max(nb_substep, 1u)))
 {
+    // Structures are queried until particles moved further than the tolerance from where they were inserted
+    qt.set_margin(conf::REBUILD_TOLERANCE);
+    lqt.set_margin(conf::REBUILD_TOLERANCE);
+    hg.set_margin(conf::REBUILD_TOLERANCE);
+
+    // Velocities are given as distances per dt, substeps move particles by a fraction of it
+    this->particles.rescale_velocities(step_dt / dt);
+
+    // Particles are generated in random order
+    if (conf::REORDER_INTERVAL > 0)
+        spatial_sort.sort(this->particles);
 }
 
 // Retrieve particles to draw them
-const std::vector<std::shared_ptr<Particle>>& Simulation::get_particles() const
+const ParticleStore& Simulation::get_particles() const
 {
     return particles;
 }
 
 // Get current QuadTree
-const QuadTree<Particle> &Simulation::get_quadtree() const
+const QuadTree<ParticleStore> &Simulation::get_quadtree() const
 {
     return qt;
 }
+
+
+// Get current LinearQuadTree
+const LinearQuadTree<ParticleStore> &Simulation::get_linear_quadtree() const
+{
+    return lqt;
+}
+
+// Choose the structure used to find neighbor particles
+void Simulation::set_spatial_index(const SpatialIndex index)
+{
+    spatial_index = index;
+    force_rebuild = true;
+}
+
+// Choose whether steps are chosen from the CFL condition
+void Simulation::set_adaptive_timestep(const bool enabled)
+{
+    adaptive_timestep = enabled;
+}
+
+// Length of the last step
+float Simulation::get_step_dt() const
+{
+    return step_dt;
+}
+
+// Rebuild the selected structure from the current positions
+void Simulation::build_tree()
+{
+    if (spatial_index == SpatialIndex::LinearQuadTree)
+    {
+        lqt.clear();
+        lqt.batch_insert(particles);
+    }
+    else if (spatial_index == SpatialIndex::HashGrid)
+        hg.batch_insert(particles);
+    else
+    {
+        // QuadTree for world, nodes from the previous build are reused
+        qt.clear();
+        if (conf::PARALLEL_TREE_BUILD)
+            qt.parallel_batch_insert(particles);
+        else
+            qt.batch_insert(particles);
+    }
+}
+
+// Length of the next step, at most time_left, velocities are rescaled if it changed
+float Simulation::next_step_dt(const float time_left)
+{
+    float next_dt = dt / static_cast<float>(std::max(nb_substep, 1u));
+
+    if (adaptive_timestep)
+    {
+        // A particle moves at most a fraction of the CFL length, from its speed or from its acceleration
+        const float max_move = conf::CFL_NUMBER * conf::CFL_LENGTH;
+        const float max_speed = particles.max_velocity() / step_dt;
+
+        next_dt = conf::DT_MAX;
+        if (max_speed > 0.0f)
+            next_dt = std::min(next_dt, max_move / max_speed);
+        if (max_acceleration > 0.0f)
+            next_dt = std::min(next_dt, std::sqrt(2.0f * max_move / max_acceleration));
+        next_dt = std::max(next_dt, conf::DT_MIN);
+    }
+
+    // End exactly at the end of the frame, without leaving a sliver of a step
+    if (time_left <= 1.001f * next_dt)
+        next_dt = time_left;
+    else if (time_left < 2.0f * next_dt)
+        next_dt = 0.5f * time_left;
+
+    // Velocities are distances travelled during a step, so they follow its length
+    if (std::abs(next_dt - step_dt) > 0.001f * step_dt)
+        particles.rescale_velocities(next_dt / step_dt);
+    step_dt = next_dt;
+
+    return next_dt;
+}
+
+// Apply the force and update every particle, the largest acceleration bounds the next step
+void Simulation::integrate(const float sub_dt, const sf::Vector2f &force)
+{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    float max_acc2 = 0.0f;
+
+#pragma omp parallel for reduction(max : max_acc2)
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        particles.apply_force(i, force);
+
+        const sf::Vector2f acc = particles.get_acceleration(i);
+        max_acc2 = std::max(max_acc2, acc.x * acc.x + acc.y * acc.y);
+
+        particles.update(i, sub_dt);
+    }
+
+    max_acceleration = std::sqrt(max_acc2);
+}
\ No newline at end of file
@@ -1,20 +1,165 @@
 #include "simulation_fluid.hpp"
 
+#include "pair_kernels.hpp"
+
+// Call fn(j) for each particle j in the query box of particle i, found with a spatial structure
+template <typename Tree, typename F>
+static void for_each_neighbor(const Tree &tree, [[maybe_unused]] const uint32_t i, const Box &query_box, F &&fn)
+{
+    tree.for_each_in(query_box, fn);
+}
+
+// Call fn(j) for each particle j in the query box of particle i, found in its neighbor list
+template <typename F>
+static void for_each_neighbor(const NeighborList &list, const uint32_t i, const Box &query_box, F &&fn)
+{
+    list.for_each_in(i, query_box, fn);
+}
+
+// Candidate neighbors of particle i, queried from a spatial structure into the given buffer
+template <typename Tree>
+static std::span<const uint32_t> neighbor_candidates(const Tree &tree, [[maybe_unused]] const uint32_t i, const Box &query_box, std::vector<uint32_t> &buffer)
+{
+    buffer.clear();
+    tree.query(query_box, buffer);
+    return buffer;
+}
+
+// Candidate neighbors of particle i, read from its neighbor list, the pair kernels filter them
+static std::span<const uint32_t> neighbor_candidates(const NeighborList &list, const uint32_t i, [[maybe_unused]] const Box &query_box, [[maybe_unused]] std::vector<uint32_t> &buffer)
+{
+    return list.get_neighbors(i);
+}
+
 // Constructor
-SimulationFluid::SimulationFluid(const std::vector<std::shared_ptr<Particle>> &particles,
+SimulationFluid::SimulationFluid(const ParticleStore &particles,
                                  const Box &world_box,
                                  const float dt,
-                                 const unsigned nb_substep) : Simulation(particles, world_box, dt, nb_substep)
+                                 const unsigned nb_substep) : Simulation(particles, world_box, dt, nb_substep),
+                                                              solver_mode(conf::SOLVER_MODE),
+                                                              grid(make_interaction_grid(particles, world_box)),
+                                                              use_neighbor_list(conf::USE_NEIGHBOR_LIST)
 {
 }
 
-// Update the simulation
+// Build a grid covering the world, with cells as small as the interaction range allows
+SpatialGrid SimulationFluid::make_interaction_grid(const ParticleStore &particles, const Box &world_box)
+{
+    // Interaction range is the half size of the largest query box used in update
+    // The grid is reused while particles move, so both particles of a pair may have moved by the tolerance
+    float max_radius = 0.0f;
+    for (uint32_t i = 0; i < particles.size(); ++i)
+        max_radius = std::max(max_radius, particles.get_radius(i));
+    const float range = std::max(4.0f * max_radius + 2.0f * conf::REBUILD_TOLERANCE, 1.0f);
+
+    // Use as many cells as possible while keeping them larger than the interaction range
+    const sf::Vector2f size = 2.0f * world_box.get_half_dimension();
+    const unsigned nb_cells_x = static_cast<unsigned>(size.x / range);
+    const unsigned nb_cells_y = static_cast<unsigned>(size.y / range);
+
+    return SpatialGrid(world_box.get_center(), size.x, size.y, nb_cells_x, nb_cells_y);
+}
+
+// Update the simulation by one frame, made of nb_substep substeps, or of adaptive substeps
 void SimulationFluid::update()
 {
-    // QuadTree for world
-    qt = QuadTree<Particle>(world_box);
-    qt.batch_insert(particles);
+    // Sort particles again once their order lost its locality, structures hold indices so they are rebuilt
+    bool rebuild = spatial_sort.update(particles) || force_rebuild;
+    force_rebuild = false;
+
+    // Every substep integrates with a fraction of dt, dt / nb_substep or a CFL bound in adaptive mode,
+    // structures are reused until a particle moved further than the tolerance, which the queries account for
+    float time_left = dt;
+    while (time_left > 0.0f)
+    {
+        const float sub_dt = next_step_dt(time_left);
+        time_left -= sub_dt;
+
+        if (rebuild || particles.max_displacement() > conf::REBUILD_TOLERANCE)
+        {
+            build_spatial_index();
+            rebuild = false;
+        }
+
+        if (uses_neighbor_list())
+            update(neighbor_list, sub_dt);
+        else if (spatial_index == SpatialIndex::LinearQuadTree)
+            update(lqt, sub_dt);
+        else if (spatial_index == SpatialIndex::HashGrid)
+            update(hg, sub_dt);
+        else
+            update(qt, sub_dt);
+    }
+}
+
+// Rebuild the selected structure, and the grid of the cell based solvers
+void SimulationFluid::build_spatial_index()
+{
+    // Cell based solvers run on their own grid and never query the tree
+    if (uses_grid())
+        grid.batch_insert(particles);
+    else
+        build_tree();
+
+    // Same range as the query boxes of the solvers, the skin covers the moves of both particles
+    // of a pair until the next build
+    if (uses_neighbor_list())
+    {
+        if (spatial_index == SpatialIndex::LinearQuadTree)
+            neighbor_list.build(particles, lqt, 4.0f, conf::NEIGHBOR_SKIN);
+        else if (spatial_index == SpatialIndex::HashGrid)
+            neighbor_list.build(particles, hg, 4.0f, conf::NEIGHBOR_SKIN);
+        else
+            neighbor_list.build(particles, qt, 4.0f, conf::NEIGHBOR_SKIN);
+    }
+
+    particles.save_reference_positions();
+}
+
+// Check if the solver reads neighbors from the lists, cell based solvers rely on their grid
+bool SimulationFluid::uses_neighbor_list() const
+{
+    return use_neighbor_list && !uses_grid();
+}
+
+// Check if the solver finds neighbors in the grid cells
+bool SimulationFluid::uses_grid() const
+{
+    return solver_mode == SolverMode::Coloring || solver_mode == SolverMode::HalfNeighbor;
+}
 
+// Run one substep using the given neighbor search structure
+template <typename Tree>
+void SimulationFluid::update(const Tree &tree, const float sub_dt)
+{
+    if (solver_mode == SolverMode::Coloring)
+        update_coloring(sub_dt);
+    else if (solver_mode == SolverMode::HalfNeighbor)
+        update_half_neighbor(sub_dt);
+    else if (solver_mode == SolverMode::Jacobi)
+        update_jacobi(tree, sub_dt);
+    else
+        update_critical(tree, sub_dt);
+}
+
+// Choose how particle interactions are resolved
+void SimulationFluid::set_solver_mode(const SolverMode mode)
+{
+    solver_mode = mode;
+    force_rebuild = true;
+}
+
+// Choose whether solvers iterate Verlet neighbor lists instead of querying the spatial structure
+void SimulationFluid::set_neighbor_list(const bool enabled)
+{
+    use_neighbor_list = enabled;
+    force_rebuild = true;
+}
+
+// Update with every interaction inside a critical section
+template <typename Tree>
+void SimulationFluid::update_critical(const Tree &tree, const float sub_dt)
+{
     // Boundaries
     const Boundary boundary = world_box.get_boundary();
     const float xmin = boundary.xmin;
@@ -22,15 +167,17 @@ void SimulationFluid::update()
     const float ymin = boundary.ymin;
     const float ymax = boundary.ymax;
 
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+
+    // Largest acceleration, particles are updated as soon as their interactions are applied
+    float max_acc2 = 0.0f;
+
 // Parallelize particle updates
-#pragma omp parallel for
-    for (size_t i = 0; i < particles.size(); ++i)
+#pragma omp parallel for reduction(max : max_acc2)
+    for (uint32_t i = 0; i < nb_particles; ++i)
     {
-        // Each thread gets its own particle reference
-        auto &p = particles[i];
-
         // Handle boundaries
-        p->handle_boundaries(xmin, xmax, ymin, ymax);
+        particles.handle_boundaries(i, xmin, xmax, ymin, ymax);
 
         // Apply gravity
         //p->apply_force({0.0f, 10.0f});
@@ -71,44 +218,247 @@ void SimulationFluid::update()
         //         }
 
         // Handle every forces around the particle
-        const Box query_box{p->get_position(), {4.0f * p->get_radius(), 4.0f * p->get_radius()}};
-        auto neighbors = qt.query(query_box);
+        const float radius = particles.get_radius(i);
+        const Box query_box{particles.get_position(i), {4.0f * radius, 4.0f * radius}};
 
-        for (size_t j = 0; j < neighbors.size(); ++j)
+        // Pair kernel is inlined into the traversal, no neighbor list is built
+        for_each_neighbor(tree, i, query_box, [&](const uint32_t j)
         {
-            auto &neighbor = neighbors[j];
-            if (p != neighbor)
+            if (i != j)
             {
 #pragma omp critical
-                {
-                    // Apply pressure
-                    apply_pressure(p, neighbor, dt);
+                interact(i, j, sub_dt);
+            }
+        });
+
+        // Update position, velocity, acceleration
+        const sf::Vector2f acc = particles.get_acceleration(i);
+        max_acc2 = std::max(max_acc2, acc.x * acc.x + acc.y * acc.y);
+        particles.update(i, sub_dt);
+    }
+
+    max_acceleration = std::sqrt(max_acc2);
+}
+
+// Update with cells processed by independent color classes
+void SimulationFluid::update_coloring(const float sub_dt)
+{
+    // Boundaries
+    const Boundary boundary = world_box.get_boundary();
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+        particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+
+    // The grid is built with the other structures, cells leave room for the tolerance
+    const unsigned nb_cells_x = grid.get_num_x();
+    const unsigned nb_cells_y = grid.get_num_y();
+
+    // Cells of the same color are 3 cells apart, so the 3x3 neighborhoods they touch never overlap
+    // and no two threads can write to the same particle
+    for (unsigned color = 0; color < 9; ++color)
+    {
+        const unsigned offset_x = color % 3;
+        const unsigned offset_y = color / 3;
+        const unsigned nb_x = (nb_cells_x + 2 - offset_x) / 3;
+        const unsigned nb_y = (nb_cells_y + 2 - offset_y) / 3;
 
-                    // Apply viscosity
-                    //apply_viscosity(p, neighbor, dt);
+#pragma omp parallel for schedule(dynamic)
+        for (unsigned k = 0; k < nb_x * nb_y; ++k)
+        {
+            const unsigned cx = offset_x + 3 * (k % nb_x);
+            const unsigned cy = offset_y + 3 * (k / nb_x);
 
-                    // Apply cohesion force
-                    //apply_cohesion(p, neighbor, dt);
+            // Neighbors come from the grid, not from live positions, so they stay in the 3x3 cells
+            const auto rows = grid.query_cell(cx, cy);
+            for (const uint32_t i : grid.get_cell(cx, cy))
+            {
+                const float radius = particles.get_radius(i);
+                const Box query_box{particles.get_position(i), {4.0f * radius, 4.0f * radius}};
 
-                    // Handle collision with other particles (using quadtree for nearby particles)
-                    if (p->is_colliding(*neighbor))
+                for (const auto &row : rows)
+                {
+                    for (const uint32_t j : row)
                     {
-                        p->solve_collision(*neighbor);
+                        if (i != j && query_box.contains(particles.get_position(j)))
+                            interact(i, j, sub_dt);
                     }
                 }
             }
         }
+    }
 
-        // Update position, velocity, acceleration
-        p->update(dt);
+    // Update position, velocity, acceleration
+    integrate(sub_dt, {0.0f, 0.0f});
+}
+
+// Update visiting every pair once, cells against themselves and their 4 forward neighbors
+void SimulationFluid::update_half_neighbor(const float sub_dt)
+{
+    // Boundaries
+    const Boundary boundary = world_box.get_boundary();
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+        particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+
+    const int nb_cells_x = static_cast<int>(grid.get_num_x());
+    const int nb_cells_y = static_cast<int>(grid.get_num_y());
+
+    // Forward neighbors, with the cell itself they cover every pair of neighbor cells once
+    constexpr int forward[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+    // A cell and its forward neighbors span 3x2 cells, cells of the same color are 3 cells apart
+    // along x and 2 along y, so the cells they touch never overlap and no two threads write
+    // to the same particle
+    for (int color = 0; color < 6; ++color)
+    {
+        const int offset_x = color % 3;
+        const int offset_y = color / 3;
+        const int nb_x = (nb_cells_x + 2 - offset_x) / 3;
+        const int nb_y = (nb_cells_y + 1 - offset_y) / 2;
+
+#pragma omp parallel for schedule(dynamic)
+        for (int k = 0; k < nb_x * nb_y; ++k)
+        {
+            const int cx = offset_x + 3 * (k % nb_x);
+            const int cy = offset_y + 2 * (k / nb_x);
+            const auto cell = grid.get_cell(static_cast<unsigned>(cx), static_cast<unsigned>(cy));
+
+            // Pairs inside the cell
+            for (size_t a = 0; a < cell.size(); ++a)
+            {
+                for (size_t b = a + 1; b < cell.size(); ++b)
+                    interact_once(cell[a], cell[b], sub_dt);
+            }
+
+            // Pairs with the forward neighbors
+            for (const auto &offset : forward)
+            {
+                const int nx = cx + offset[0];
+                const int ny = cy + offset[1];
+                if (nx < 0 || nx >= nb_cells_x || ny >= nb_cells_y)
+                    continue;
+
+                const auto neighbor = grid.get_cell(static_cast<unsigned>(nx), static_cast<unsigned>(ny));
+                for (const uint32_t i : cell)
+                {
+                    for (const uint32_t j : neighbor)
+                        interact_once(i, j, sub_dt);
+                }
+            }
+        }
+    }
+
+    // Update position, velocity, acceleration
+    integrate(sub_dt, {0.0f, 0.0f});
+}
+
+// Update with double-buffered Jacobi iterations
+template <typename Tree>
+void SimulationFluid::update_jacobi(const Tree &tree, const float sub_dt)
+{
+    // Boundaries
+    const Boundary boundary = world_box.get_boundary();
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+        particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+
+    // Pair sums run on the vector kernels picked for this CPU
+    const PairKernels &kernels = get_pair_kernels();
+
+    // The other solvers apply a pair from both of its particles, and each time to both of them,
+    // so a particle gathering its own share counts the pressure of every pair twice
+    // The second collision visit only closes PARTICLE_DAMPING of what the first one left, so two
+    // visits close 1 - (1 - d)^2 = (2 - d) d of the overlap
+    constexpr float pressure_visits = 2.0f;
+    constexpr float collision_visits = 2.0f - conf::PARTICLE_DAMPING;
+
+    // Pressure, each particle only gathers the force applied to itself
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        const float half_size = 4.0f * particles.get_radius(i);
+        const Box query_box{particles.get_position(i), {half_size, half_size}};
+
+        // Each thread reuses its own candidate buffer, so queries do not allocate
+        thread_local std::vector<uint32_t> buffer;
+        const auto candidates = neighbor_candidates(tree, i, query_box, buffer);
+        particles.apply_force(i, pressure_visits * kernels.pressure(particles, i, candidates, half_size));
+    }
+
+    // Collisions, positions are read from the current buffer and written to the next one
+    // Neighbors are visited in tree order, so results do not depend on the thread count
+    for (unsigned iteration = 0; iteration < conf::JACOBI_ITERATIONS; ++iteration)
+    {
+#pragma omp parallel for
+        for (uint32_t i = 0; i < nb_particles; ++i)
+        {
+            const float half_size = 4.0f * particles.get_radius(i);
+            const Box query_box{particles.get_position(i), {half_size, half_size}};
+
+            thread_local std::vector<uint32_t> buffer;
+            const auto candidates = neighbor_candidates(tree, i, query_box, buffer);
+            particles.set_next_position(i, particles.get_position(i) + collision_visits * kernels.collision(particles, i, candidates, half_size));
+        }
+
+        particles.swap_positions();
     }
+
+    // Update position, velocity, acceleration
+    integrate(sub_dt, {0.0f, 0.0f});
+}
+
+// Apply every interaction between two particles
+void SimulationFluid::interact(const uint32_t i, const uint32_t j, const float sub_dt)
+{
+    // Apply pressure
+    apply_pressure(i, j, sub_dt);
+
+    // Apply viscosity
+    //apply_viscosity(i, j, sub_dt);
+
+    // Apply cohesion force
+    //apply_cohesion(i, j, sub_dt);
+
+    // Handle collision with other particles
+    if (particles.is_colliding(i, j))
+        particles.solve_collision(i, j);
+}
+
+// Apply every interaction between two particles visited only once
+void SimulationFluid::interact_once(const uint32_t i, const uint32_t j, const float sub_dt)
+{
+    // The other solvers visit the pair from each particle whose query box holds the other one,
+    // and apply both particles' share every time, so do the same here
+    const float half_size_i = 4.0f * particles.get_radius(i);
+    const Box query_box_i{particles.get_position(i), {half_size_i, half_size_i}};
+    if (query_box_i.contains(particles.get_position(j)))
+        interact(i, j, sub_dt);
+
+    const float half_size_j = 4.0f * particles.get_radius(j);
+    const Box query_box_j{particles.get_position(j), {half_size_j, half_size_j}};
+    if (query_box_j.contains(particles.get_position(i)))
+        interact(j, i, sub_dt);
 }
 
 // Apply pressure force to the given particles
-void SimulationFluid::apply_pressure(std::shared_ptr<Particle> &p, std::shared_ptr<Particle> &neighbor, [[maybe_unused]]const float dt)
+void SimulationFluid::apply_pressure(const uint32_t i, const uint32_t j, [[maybe_unused]]const float dt)
+{
+    const sf::Vector2f pressure_force = compute_pressure(i, j);
+    particles.apply_force(i, pressure_force);
+    particles.apply_force(j, -pressure_force);
+}
+
+// Pressure force applied to particle i by particle j
+sf::Vector2f SimulationFluid::compute_pressure(const uint32_t i, const uint32_t j) const
 {
-    const sf::Vector2f pos1 = p->get_position();
-    const sf::Vector2f pos2 = neighbor->get_position();
+    const sf::Vector2f pos1 = particles.get_position(i);
+    const sf::Vector2f pos2 = particles.get_position(j);
     // std::cout << pos1.x << "," << pos1.y << " / " << pos2.x << "," << pos2.y << std::endl;
     const float dist = std::sqrt((pos1.x - pos2.x) * (pos1.x - pos2.x) + (pos1.y - pos2.y) * (pos1.y - pos2.y));
 
@@ -120,33 +470,29 @@ void SimulationFluid::apply_pressure(std::shared_ptr<Particle> &p, std::shared_p
     // Apply force
     // const float threshold_dist = 10.0f;
     // if (dist < threshold_dist)
-    {
-        const float pressure_coef = 1.0f;
-        const sf::Vector2f pressure_force = pressure_coef * normal;
-        p->apply_force(pressure_force);
-        neighbor->apply_force(-pressure_force);
-    }
+    const float pressure_coef = 1.0f;
+    return pressure_coef * normal;
 }
 
 // Apply viscosity force to the given particles
-void SimulationFluid::apply_viscosity(std::shared_ptr<Particle> &p, std::shared_ptr<Particle> &neighbor, const float dt)
+void SimulationFluid::apply_viscosity(const uint32_t i, const uint32_t j, const float dt)
 {
-    const sf::Vector2f vel1 = p->get_position() * dt;
-    const sf::Vector2f vel2 = p->get_position() * dt;
+    const sf::Vector2f vel1 = particles.get_position(i) * dt;
+    const sf::Vector2f vel2 = particles.get_position(i) * dt;
     const sf::Vector2f relative_vel = vel2 - vel1;
 
     // Apply force
     const float viscosity_coef = 1.0f;
     const sf::Vector2f viscosity_force = viscosity_coef * sf::Vector2f{relative_vel.x * relative_vel.x, relative_vel.y * relative_vel.y};
-    p->apply_force(viscosity_force);
-    neighbor->apply_force(-viscosity_force);
+    particles.apply_force(i, viscosity_force);
+    particles.apply_force(j, -viscosity_force);
 }
 
 // Apply cohesion force to the given particles
-void SimulationFluid::apply_cohesion(std::shared_ptr<Particle> &p, std::shared_ptr<Particle> &neighbor, [[maybe_unused]]const float dt)
+void SimulationFluid::apply_cohesion(const uint32_t i, const uint32_t j, [[maybe_unused]]const float dt)
 {
-    const sf::Vector2f pos1 = p->get_position();
-    const sf::Vector2f pos2 = neighbor->get_position();
+    const sf::Vector2f pos1 = particles.get_position(i);
+    const sf::Vector2f pos2 = particles.get_position(j);
     const float dist = std::sqrt((pos1.x - pos2.x) * (pos1.x - pos2.x) + (pos1.y - pos2.y) * (pos1.y - pos2.y));
 
     // Direction of the force
@@ -161,7 +507,7 @@ void SimulationFluid::apply_cohesion(std::shared_ptr<Particle> &p, std::shared_p
     if (dist > min_dist && dist < max_dist)
     {
         sf::Vector2f cohesion_force = cohesion_coef * normal;
-        p->apply_force(cohesion_force);
-        neighbor->apply_force(-cohesion_force);
+        particles.apply_force(i, cohesion_force);
+        particles.apply_force(j, -cohesion_force);
     }
 }
\ No newline at end of file
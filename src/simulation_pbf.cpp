@@ -0,0 +1,158 @@
+#include "simulation_pbf.hpp"
+
+// Constructor
+SimulationPBF::SimulationPBF(const ParticleStore &particles,
+                             const Box &world_box,
+                             const float dt,
+                             const unsigned nb_substep) : Simulation(particles, world_box, dt, nb_substep),
+                                                          kernels(conf::SPH_SMOOTHING_LENGTH, conf::SPH_KERNEL_TABLE_SIZE),
+                                                          iterations(conf::PBF_ITERATIONS)
+{
+}
+
+// Update the simulation by one frame, made of nb_substep substeps, or of adaptive substeps
+void SimulationPBF::update()
+{
+    // Sort particles again once their order lost its locality, structures hold indices so they are rebuilt
+    rebuild = spatial_sort.update(particles) || force_rebuild || rebuild;
+    force_rebuild = false;
+
+    const Boundary boundary = world_box.get_boundary();
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+
+    // Substeps last dt / nb_substep, or a CFL bound in adaptive mode
+    float time_left = dt;
+    while (time_left > 0.0f)
+    {
+        const float sub_dt = next_step_dt(time_left);
+        time_left -= sub_dt;
+
+        // Predict positions, the previous ones are kept as position_old
+        integrate(sub_dt, conf::SPH_GRAVITY);
+
+        // Corrections move particles, so the structure is checked before each iteration
+        for (unsigned iteration = 0; iteration < iterations; ++iteration)
+        {
+            refresh_tree();
+
+            if (spatial_index == SpatialIndex::LinearQuadTree)
+                solve(lqt);
+            else if (spatial_index == SpatialIndex::HashGrid)
+                solve(hg);
+            else
+                solve(qt);
+        }
+
+        // Boundaries, position_old is reflected so the velocity bounces
+#pragma omp parallel for
+        for (uint32_t i = 0; i < nb_particles; ++i)
+            particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+    }
+}
+
+// Choose the number of Jacobi iterations on the density constraints per substep
+void SimulationPBF::set_iterations(const unsigned iterations)
+{
+    this->iterations = iterations;
+}
+
+// Density of particle i at the last iteration
+float SimulationPBF::get_density(const uint32_t i) const
+{
+    return densities[i];
+}
+
+// Rebuild the selected structure if a particle moved further than the tolerance
+void SimulationPBF::refresh_tree()
+{
+    if (rebuild || particles.max_displacement() > conf::REBUILD_TOLERANCE)
+    {
+        build_tree();
+        particles.save_reference_positions();
+        rebuild = false;
+    }
+}
+
+// Run one iteration using the given neighbor search structure
+template <typename Tree>
+void SimulationPBF::solve(const Tree &tree)
+{
+    // Corrections need the multiplier of every neighbor, so the two passes are separate
+    compute_lambdas(tree);
+    apply_corrections(tree);
+    particles.swap_positions();
+}
+
+// Density and constraint multiplier of every particle
+template <typename Tree>
+void SimulationPBF::compute_lambdas(const Tree &tree)
+{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    densities.resize(nb_particles);
+    lambdas.resize(nb_particles);
+
+    const float h = kernels.get_smoothing_length();
+    const float inv_rest_density = 1.0f / conf::SPH_REST_DENSITY;
+
+    // Each particle only writes its own values
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        const sf::Vector2f pos = particles.get_position(i);
+        const Box query_box{pos, {h, h}};
+
+        // Density, and the gradients of the constraint C = density / rest density - 1
+        float density = 0.0f;
+        sf::Vector2f grad_i{0.0f, 0.0f};
+        float sum_grad2 = 0.0f;
+        tree.for_each_in(query_box, [&](const uint32_t j)
+        {
+            const sf::Vector2f d = pos - particles.get_position(j);
+            const float r2 = d.x * d.x + d.y * d.y;
+            density += particles.get_mass(j) * kernels.density(r2);
+
+            if (i == j)
+                return;
+
+            const sf::Vector2f grad_j = (particles.get_mass(j) * inv_rest_density * kernels.pressure_gradient(r2)) * d;
+            grad_i += grad_j;
+            sum_grad2 += grad_j.x * grad_j.x + grad_j.y * grad_j.y;
+        });
+        sum_grad2 += grad_i.x * grad_i.x + grad_i.y * grad_i.y;
+
+        // Only compression is corrected, particles do not pull each other into clumps
+        const float constraint = std::max(density * inv_rest_density - 1.0f, 0.0f);
+        densities[i] = density;
+        lambdas[i] = -constraint / (sum_grad2 + conf::PBF_RELAXATION);
+    }
+}
+
+// Move every particle to satisfy the constraints of its neighbors
+template <typename Tree>
+void SimulationPBF::apply_corrections(const Tree &tree)
+{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    const float h = kernels.get_smoothing_length();
+    const float inv_rest_density = 1.0f / conf::SPH_REST_DENSITY;
+
+    // Positions are read from the current buffer and written to the next one
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        const sf::Vector2f pos = particles.get_position(i);
+        const Box query_box{pos, {h, h}};
+
+        sf::Vector2f correction{0.0f, 0.0f};
+        tree.for_each_in(query_box, [&](const uint32_t j)
+        {
+            if (i == j)
+                return;
+
+            const sf::Vector2f d = pos - particles.get_position(j);
+            const float r2 = d.x * d.x + d.y * d.y;
+            correction += (particles.get_mass(j) * (lambdas[i] + lambdas[j]) * kernels.pressure_gradient(r2)) * d;
+        });
+
+        particles.set_next_position(i, pos + inv_rest_density * correction);
+    }
+}
@@ -0,0 +1,134 @@
+#include "simulation_sph.hpp"
+
+// Constructor
+SimulationSPH::SimulationSPH(const ParticleStore &particles,
+                             const Box &world_box,
+                             const float dt,
+                             const unsigned nb_substep) : Simulation(particles, world_box, dt, nb_substep),
+                                                          kernels(conf::SPH_SMOOTHING_LENGTH, conf::SPH_KERNEL_TABLE_SIZE)
+{
+}
+
+// Update the simulation by one frame, made of nb_substep substeps, or of adaptive substeps
+void SimulationSPH::update()
+{
+    // Sort particles again once their order lost its locality, structures hold indices so they are rebuilt
+    bool rebuild = spatial_sort.update(particles) || force_rebuild;
+    force_rebuild = false;
+
+    // Substeps last dt / nb_substep, or a CFL bound in adaptive mode
+    // Structures are reused until a particle moved further than the tolerance, which the queries account for
+    float time_left = dt;
+    while (time_left > 0.0f)
+    {
+        const float sub_dt = next_step_dt(time_left);
+        time_left -= sub_dt;
+
+        if (rebuild || particles.max_displacement() > conf::REBUILD_TOLERANCE)
+        {
+            build_tree();
+            particles.save_reference_positions();
+            rebuild = false;
+        }
+
+        if (spatial_index == SpatialIndex::LinearQuadTree)
+            update(lqt, sub_dt);
+        else if (spatial_index == SpatialIndex::HashGrid)
+            update(hg, sub_dt);
+        else
+            update(qt, sub_dt);
+    }
+}
+
+// Density of particle i at the last substep
+float SimulationSPH::get_density(const uint32_t i) const
+{
+    return densities[i];
+}
+
+// Run one substep using the given neighbor search structure
+template <typename Tree>
+void SimulationSPH::update(const Tree &tree, const float sub_dt)
+{
+    // Boundaries
+    const Boundary boundary = world_box.get_boundary();
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+        particles.handle_boundaries(i, boundary.xmin, boundary.xmax, boundary.ymin, boundary.ymax);
+
+    // Forces need the density of every neighbor, so the two passes are separate
+    compute_densities(tree);
+    apply_forces(tree, sub_dt);
+
+    // Update position, velocity, acceleration
+    integrate(sub_dt, conf::SPH_GRAVITY);
+}
+
+// Density and pressure of every particle
+template <typename Tree>
+void SimulationSPH::compute_densities(const Tree &tree)
+{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    densities.resize(nb_particles);
+    pressures.resize(nb_particles);
+
+    const float h = kernels.get_smoothing_length();
+
+    // Each particle only writes its own density, the sum includes the particle itself
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        const sf::Vector2f pos = particles.get_position(i);
+        const Box query_box{pos, {h, h}};
+
+        float density = 0.0f;
+        tree.for_each_in(query_box, [&](const uint32_t j)
+        {
+            const sf::Vector2f d = pos - particles.get_position(j);
+            density += particles.get_mass(j) * kernels.density(d.x * d.x + d.y * d.y);
+        });
+
+        // Only compression is resisted, particles do not pull each other into clumps
+        densities[i] = density;
+        pressures[i] = std::max(conf::SPH_STIFFNESS * (density - conf::SPH_REST_DENSITY), 0.0f);
+    }
+}
+
+// Apply pressure and viscosity forces to every particle
+template <typename Tree>
+void SimulationSPH::apply_forces(const Tree &tree, const float sub_dt)
+{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    const float h = kernels.get_smoothing_length();
+
+    // Each particle only gathers the acceleration applied to itself
+#pragma omp parallel for
+    for (uint32_t i = 0; i < nb_particles; ++i)
+    {
+        const sf::Vector2f pos = particles.get_position(i);
+        const sf::Vector2f vel = particles.get_velocity(i) / sub_dt;
+        const Box query_box{pos, {h, h}};
+
+        sf::Vector2f pressure_acc{0.0f, 0.0f};
+        sf::Vector2f viscosity_acc{0.0f, 0.0f};
+        tree.for_each_in(query_box, [&](const uint32_t j)
+        {
+            if (i == j)
+                return;
+
+            const sf::Vector2f d = pos - particles.get_position(j);
+            const float r2 = d.x * d.x + d.y * d.y;
+            const float mass_ratio = particles.get_mass(j) / densities[j];
+
+            // Symmetric pressure term, so pairs push each other equally
+            pressure_acc -= (0.5f * mass_ratio * (pressures[i] + pressures[j]) * kernels.pressure_gradient(r2)) * d;
+
+            const sf::Vector2f relative_vel = particles.get_velocity(j) / sub_dt - vel;
+            viscosity_acc += (mass_ratio * kernels.viscosity(r2)) * relative_vel;
+        });
+
+        particles.apply_force(i, (pressure_acc + conf::SPH_VISCOSITY * viscosity_acc) / densities[i]);
+    }
+}
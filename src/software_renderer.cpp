@@ -0,0 +1,243 @@
+#include "software_renderer.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SOFTWARE_RENDERER_SSE2
+#include <immintrin.h>
+#endif
+
+// Background color, opaque black
+static constexpr uint32_t background = 0xFF000000u;
+
+// Pack a color in memory order red, green, blue, alpha
+static uint32_t pack(const sf::Color &color)
+{
+    return static_cast<uint32_t>(color.r) |
+           static_cast<uint32_t>(color.g) << 8 |
+           static_cast<uint32_t>(color.b) << 16 |
+           static_cast<uint32_t>(color.a) << 24;
+}
+
+// Fill count pixels with the same value, 4 pixels per store when SSE2 is available
+static void fill_span(uint32_t *dst, const size_t count, const uint32_t value)
+{
+    size_t k = 0;
+
+#ifdef SOFTWARE_RENDERER_SSE2
+    const __m128i v = _mm_set1_epi32(static_cast<int>(value));
+    for (; k + 4 <= count; k += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + k), v);
+#endif
+
+    for (; k < count; ++k)
+        dst[k] = value;
+}
+
+// Disc of a particle in pixels
+struct Disc
+{
+    float cx, cy, r;
+};
+
+// Constructor
+SoftwareRenderer::SoftwareRenderer(const unsigned width,
+                                   const unsigned height,
+                                   const sf::Vector2f &view_center,
+                                   const sf::Vector2f &view_size) : width(width),
+                                                                    height(height),
+                                                                    nb_tiles_x((width + tile_size - 1) / tile_size),
+                                                                    nb_tiles_y((height + tile_size - 1) / tile_size),
+                                                                    scale(std::min(width / view_size.x, height / view_size.y)),
+                                                                    pixels(static_cast<size_t>(width) * height, background),
+                                                                    tile_starts(nb_tiles_x * nb_tiles_y + 1, 0)
+{
+    origin = view_center - sf::Vector2f{0.5f * width / scale, 0.5f * height / scale};
+}
+
+// Draw every particle on a black background
+void SoftwareRenderer::render(const ParticleStore &particles)
+{
+    bin(particles);
+
+    // Tiles do not overlap, so each one is drawn by a single thread
+    const unsigned nb_tiles = nb_tiles_x * nb_tiles_y;
+
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned tile = 0; tile < nb_tiles; ++tile)
+        draw_tile(particles, tile);
+}
+
+// Sort particles by the tiles they overlap
+void SoftwareRenderer::bin(const ParticleStore &particles)
+{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    const unsigned nb_tiles = nb_tiles_x * nb_tiles_y;
+    const uint32_t nb_blocks = std::min(max_blocks, nb_particles / 4096 + 1);
+
+    const float *xs = particles.get_x();
+    const float *ys = particles.get_y();
+    const float *radii = particles.get_radii();
+
+    // Call fn(tile) for each tile the disc of particle i overlaps
+    const auto for_each_tile = [&](const uint32_t i, auto &&fn)
+    {
+        const Disc d{(xs[i] - origin.x) * scale, (ys[i] - origin.y) * scale, radii[i] * scale};
+        if (d.cx + d.r < 0.0f || d.cy + d.r < 0.0f || d.cx - d.r >= width || d.cy - d.r >= height)
+            return;
+
+        const unsigned tx0 = static_cast<unsigned>(std::max(d.cx - d.r, 0.0f)) / tile_size;
+        const unsigned ty0 = static_cast<unsigned>(std::max(d.cy - d.r, 0.0f)) / tile_size;
+        const unsigned tx1 = static_cast<unsigned>(std::min(d.cx + d.r, width - 1.0f)) / tile_size;
+        const unsigned ty1 = static_cast<unsigned>(std::min(d.cy + d.r, height - 1.0f)) / tile_size;
+        for (unsigned ty = ty0; ty <= ty1; ++ty)
+        {
+            for (unsigned tx = tx0; tx <= tx1; ++tx)
+                fn(ty * nb_tiles_x + tx);
+        }
+    };
+
+    // Number of particles per block and tile
+    block_offsets.assign(static_cast<size_t>(nb_blocks) * nb_tiles, 0);
+
+#pragma omp parallel for
+    for (uint32_t block = 0; block < nb_blocks; ++block)
+    {
+        uint32_t *counts = &block_offsets[static_cast<size_t>(block) * nb_tiles];
+        const uint32_t begin = static_cast<uint32_t>(uint64_t{nb_particles} * block / nb_blocks);
+        const uint32_t end = static_cast<uint32_t>(uint64_t{nb_particles} * (block + 1) / nb_blocks);
+        for (uint32_t i = begin; i < end; ++i)
+            for_each_tile(i, [&](const unsigned tile) { counts[tile]++; });
+    }
+
+    // Offsets, tile by tile then block by block, keeps the storage order in each tile
+    uint32_t offset = 0;
+    for (unsigned tile = 0; tile < nb_tiles; ++tile)
+    {
+        tile_starts[tile] = offset;
+        for (uint32_t block = 0; block < nb_blocks; ++block)
+        {
+            uint32_t &count = block_offsets[static_cast<size_t>(block) * nb_tiles + tile];
+            const uint32_t c = count;
+            count = offset;
+            offset += c;
+        }
+    }
+    tile_starts[nb_tiles] = offset;
+    tile_particles.resize(offset);
+
+#pragma omp parallel for
+    for (uint32_t block = 0; block < nb_blocks; ++block)
+    {
+        uint32_t *offsets = &block_offsets[static_cast<size_t>(block) * nb_tiles];
+        const uint32_t begin = static_cast<uint32_t>(uint64_t{nb_particles} * block / nb_blocks);
+        const uint32_t end = static_cast<uint32_t>(uint64_t{nb_particles} * (block + 1) / nb_blocks);
+        for (uint32_t i = begin; i < end; ++i)
+            for_each_tile(i, [&](const unsigned tile) { tile_particles[offsets[tile]++] = i; });
+    }
+}
+
+// Draw the particles binned to a tile
+void SoftwareRenderer::draw_tile(const ParticleStore &particles, const unsigned tile)
+{
+    const int x0 = static_cast<int>((tile % nb_tiles_x) * tile_size);
+    const int y0 = static_cast<int>((tile / nb_tiles_x) * tile_size);
+    const int x1 = std::min(x0 + static_cast<int>(tile_size), static_cast<int>(width));
+    const int y1 = std::min(y0 + static_cast<int>(tile_size), static_cast<int>(height));
+
+    // Clear the tile
+    for (int y = y0; y < y1; ++y)
+        fill_span(&pixels[static_cast<size_t>(y) * width + x0], x1 - x0, background);
+
+    const float *xs = particles.get_x();
+    const float *ys = particles.get_y();
+    const float *radii = particles.get_radii();
+    const sf::Color *colors = particles.get_colors();
+
+    // Particles later in storage order are drawn on top
+    for (uint32_t k = tile_starts[tile]; k < tile_starts[tile + 1]; ++k)
+    {
+        const uint32_t i = tile_particles[k];
+        const Disc d{(xs[i] - origin.x) * scale, (ys[i] - origin.y) * scale, radii[i] * scale};
+        const uint32_t value = pack(colors[i]);
+
+        // Discs smaller than a pixel are a single pixel
+        if (d.r < 0.5f)
+        {
+            const int px = static_cast<int>(std::floor(d.cx));
+            const int py = static_cast<int>(std::floor(d.cy));
+            if (x0 <= px && px < x1 && y0 <= py && py < y1)
+                pixels[static_cast<size_t>(py) * width + px] = value;
+            continue;
+        }
+
+        // Rows whose pixel centers are inside the disc, then the span of each row
+        const int row_begin = std::max(y0, static_cast<int>(std::ceil(d.cy - d.r - 0.5f)));
+        const int row_end = std::min(y1, static_cast<int>(std::floor(d.cy + d.r - 0.5f)) + 1);
+        for (int y = row_begin; y < row_end; ++y)
+        {
+            const float dy = y + 0.5f - d.cy;
+            const float half = std::sqrt(std::max(d.r * d.r - dy * dy, 0.0f));
+            const int span_begin = std::max(x0, static_cast<int>(std::ceil(d.cx - half - 0.5f)));
+            const int span_end = std::min(x1, static_cast<int>(std::floor(d.cx + half - 0.5f)) + 1);
+            if (span_begin < span_end)
+                fill_span(&pixels[static_cast<size_t>(y) * width + span_begin], span_end - span_begin, value);
+        }
+    }
+}
+
+// Image size
+unsigned SoftwareRenderer::get_width() const
+{
+    return width;
+}
+
+unsigned SoftwareRenderer::get_height() const
+{
+    return height;
+}
+
+// Pixels, row by row, 4 bytes per pixel
+const uint8_t *SoftwareRenderer::get_pixels() const
+{
+    return reinterpret_cast<const uint8_t *>(pixels.data());
+}
+
+// Write the image as a binary PPM file
+bool SoftwareRenderer::save_ppm(const std::string &path)
+{
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    rgb.resize(3 * static_cast<size_t>(width) * height);
+    const uint8_t *src = get_pixels();
+
+#pragma omp parallel for
+    for (size_t k = 0; k < pixels.size(); ++k)
+    {
+        rgb[3 * k + 0] = src[4 * k + 0];
+        rgb[3 * k + 1] = src[4 * k + 1];
+        rgb[3 * k + 2] = src[4 * k + 2];
+    }
+
+    std::fprintf(file, "P6\n%u %u\n255\n", width, height);
+    const bool ok = std::fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+
+    return std::fclose(file) == 0 && ok;
+}
+
+// Write the image as a PNG file
+bool SoftwareRenderer::save_png(const std::string &path)
+{
+    image.create(width, height, get_pixels());
+    return image.saveToFile(path);
+}
+
+// Write the raw RGBA pixels
+bool SoftwareRenderer::write_raw(std::FILE *file) const
+{
+    const size_t size = 4 * pixels.size();
+    return std::fwrite(get_pixels(), 1, size, file) == size && std::fflush(file) == 0;
+}
@@ -1,37 +1,158 @@
 #include "spatial_grid.hpp"
 
+#include <omp.h>
+
 // Constructor
 SpatialGrid::SpatialGrid(const sf::Vector2f center,
                          const float width,
                          const float height,
                          const unsigned num_cells_x,
-                         const unsigned num_cells_y) :center(center), width(width), height(height), num_x(num_cells_x), num_y(num_cells_y)
+                         const unsigned num_cells_y) :center(center), width(width), height(height), num_x(std::max(num_cells_x, 1u)), num_y(std::max(num_cells_y, 1u))
 {
     cell_size = {width / static_cast<float>(num_x), height / static_cast<float>(num_y)};
-    grid.reserve(num_x * num_y);
+    origin = center - sf::Vector2f{width / 2.0f, height / 2.0f};
+    cell_start.assign(num_x * num_y + 1, 0);
 }
 
-// Insert an object in the grid
-void SpatialGrid::insert([[maybe_unused]]const std::shared_ptr<Object> &obj)
+// Sort every particle of the store by cell, in parallel
+// Each thread counts a contiguous block of particles, so the sort is stable and
+// the result does not depend on the number of threads
+void SpatialGrid::batch_insert(const ParticleStore &particles)
 {
-}
+    this->particles = &particles;
 
-// Remove an object from the grid
-void SpatialGrid::remove([[maybe_unused]]const std::shared_ptr<Object> &obj)
-{
+    const uint32_t nb_particles = static_cast<uint32_t>(particles.size());
+    const unsigned nb_cells = num_x * num_y;
+
+    particle_cell.resize(nb_particles);
+    indices.resize(nb_particles);
+    cell_start.resize(nb_cells + 1);
+
+#pragma omp parallel
+    {
+        const unsigned nb_threads = static_cast<unsigned>(omp_get_num_threads());
+        const unsigned thread = static_cast<unsigned>(omp_get_thread_num());
+
+        // Block of particles handled by this thread
+        const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(nb_particles) * thread / nb_threads);
+        const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(nb_particles) * (thread + 1) / nb_threads);
+
+#pragma omp single
+        thread_counts.assign(static_cast<size_t>(nb_threads) * nb_cells, 0);
+
+        // Count particles per cell
+        uint32_t *counts = thread_counts.data() + static_cast<size_t>(thread) * nb_cells;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const sf::Vector2f pos = particles.get_position(i);
+            const uint32_t cell = cell_y(pos.y) * num_x + cell_x(pos.x);
+            particle_cell[i] = cell;
+            counts[cell]++;
+        }
+
+#pragma omp barrier
+
+        // Total per cell
+#pragma omp for
+        for (unsigned c = 0; c < nb_cells; ++c)
+        {
+            uint32_t total = 0;
+            for (unsigned t = 0; t < nb_threads; ++t)
+                total += thread_counts[static_cast<size_t>(t) * nb_cells + c];
+            cell_start[c + 1] = total;
+        }
+
+        // Exclusive scan over cells
+#pragma omp single
+        {
+            cell_start[0] = 0;
+            for (unsigned c = 0; c < nb_cells; ++c)
+                cell_start[c + 1] += cell_start[c];
+        }
+
+        // Where each thread starts writing in each cell
+#pragma omp for
+        for (unsigned c = 0; c < nb_cells; ++c)
+        {
+            uint32_t offset = cell_start[c];
+            for (unsigned t = 0; t < nb_threads; ++t)
+            {
+                uint32_t &count = thread_counts[static_cast<size_t>(t) * nb_cells + c];
+                const uint32_t n = count;
+                count = offset;
+                offset += n;
+            }
+        }
+
+        // Scatter, in index order inside each block
+        for (uint32_t i = begin; i < end; ++i)
+            indices[counts[particle_cell[i]]++] = i;
+    }
 }
 
 // Clear the grid
 void SpatialGrid::clear()
 {
-    for(auto &e: grid)
-        e.clear();
+    indices.clear();
+    std::fill(cell_start.begin(), cell_start.end(), 0);
+}
+
+// Find particles in the 3x3 cells around the given position
+std::array<std::span<const uint32_t>, 3> SpatialGrid::query(const sf::Vector2f &pos) const
+{
+    return query_cell(cell_x(pos.x), cell_y(pos.y));
+}
+
+// Find particles in the 3x3 cells around the given cell
+std::array<std::span<const uint32_t>, 3> SpatialGrid::query_cell(const unsigned x, const unsigned y) const
+{
+    const unsigned x_first = x > 0 ? x - 1 : 0;
+    const unsigned x_last = std::min(x + 1, num_x - 1);
+
+    std::array<std::span<const uint32_t>, 3> rows;
+    if (y > 0)
+        rows[0] = get_row(y - 1, x_first, x_last);
+    rows[1] = get_row(y, x_first, x_last);
+    if (y + 1 < num_y)
+        rows[2] = get_row(y + 1, x_first, x_last);
+
+    return rows;
+}
+
+// Particles of the given cell
+std::span<const uint32_t> SpatialGrid::get_cell(const unsigned x, const unsigned y) const
+{
+    return get_row(y, x, x);
+}
+
+// Number of cells along each axis
+unsigned SpatialGrid::get_num_x() const
+{
+    return num_x;
 }
 
-// Find objects near given object
-std::vector<std::shared_ptr<Object>> SpatialGrid::query([[maybe_unused]]const std::shared_ptr<Object> &obj) const
+unsigned SpatialGrid::get_num_y() const
 {
-    std::vector<std::shared_ptr<Object>> result;
+    return num_y;
+}
 
-    return result;
-}
\ No newline at end of file
+// Convert position to cell coords, clamped to the grid
+unsigned SpatialGrid::cell_x(const float x) const
+{
+    const int cx = static_cast<int>((x - origin.x) / cell_size.x);
+    return static_cast<unsigned>(std::clamp(cx, 0, static_cast<int>(num_x) - 1));
+}
+
+unsigned SpatialGrid::cell_y(const float y) const
+{
+    const int cy = static_cast<int>((y - origin.y) / cell_size.y);
+    return static_cast<unsigned>(std::clamp(cy, 0, static_cast<int>(num_y) - 1));
+}
+
+// Particles of cells x_first to x_last of row y
+std::span<const uint32_t> SpatialGrid::get_row(const unsigned y, const unsigned x_first, const unsigned x_last) const
+{
+    const uint32_t begin = cell_start[y * num_x + x_first];
+    const uint32_t end = cell_start[y * num_x + x_last + 1];
+    return {indices.data() + begin, end - begin};
+}
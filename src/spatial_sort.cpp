@@ -0,0 +1,85 @@
+#include "spatial_sort.hpp"
+
+#include <cmath>
+
+#include "morton.hpp"
+#include "radix_sort.hpp"
+
+// Constructor
+SpatialSort::SpatialSort(const Box &world_box,
+                         const float cell_size,
+                         const unsigned interval,
+                         const float min_locality) : interval(interval), min_locality(min_locality)
+{
+    origin = world_box.get_center() - world_box.get_half_dimension();
+    const sf::Vector2f size = 2.0f * world_box.get_half_dimension();
+
+    const float nb_cells = static_cast<float>(1u << MORTON_BITS);
+    scale = {nb_cells / size.x, nb_cells / size.y};
+
+    // Drop key levels until a cell is at least as large as the given size
+    unsigned levels = 0;
+    while (levels + 1 < MORTON_BITS && std::min(size.x, size.y) / static_cast<float>(1u << (MORTON_BITS - levels)) < cell_size)
+        ++levels;
+    coarse_shift = 2 * levels;
+}
+
+// Called once per frame, sort particles if the locality check is due and fails
+bool SpatialSort::update(ParticleStore &particles)
+{
+    if (interval == 0 || ++frame < interval)
+        return false;
+    frame = 0;
+
+    if (measure_locality(particles) >= min_locality)
+        return false;
+
+    sort(particles);
+    return true;
+}
+
+// Sort particles along the curve
+void SpatialSort::sort(ParticleStore &particles)
+{
+    compute_keys(particles);
+
+    const uint32_t n = static_cast<uint32_t>(keys.size());
+    order.resize(n);
+#pragma omp parallel for
+    for (uint32_t i = 0; i < n; ++i)
+        order[i] = i;
+
+    radix_sort(keys, order, tmp_keys, tmp_order, thread_counts);
+    particles.reorder(order);
+}
+
+// Fraction of consecutive particles whose cells follow the curve order
+float SpatialSort::measure_locality(const ParticleStore &particles)
+{
+    compute_keys(particles);
+
+    const uint32_t n = static_cast<uint32_t>(keys.size());
+    if (n < 2)
+        return 1.0f;
+
+    uint32_t ordered = 0;
+#pragma omp parallel for reduction(+ : ordered)
+    for (uint32_t i = 0; i < n - 1; ++i)
+    {
+        if ((keys[i] >> coarse_shift) <= (keys[i + 1] >> coarse_shift))
+            ordered++;
+    }
+
+    return static_cast<float>(ordered) / static_cast<float>(n - 1);
+}
+
+// Compute the key of every particle
+void SpatialSort::compute_keys(const ParticleStore &particles)
+{
+    const uint32_t n = static_cast<uint32_t>(particles.size());
+    keys.resize(n);
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < n; ++i)
+        keys[i] = morton_key(particles.get_position(i), origin, scale);
+}
@@ -0,0 +1,37 @@
+#include "sph_kernels.hpp"
+
+#include <cmath>
+#include <numbers>
+
+// Constructor
+SphKernels::SphKernels(const float smoothing_length, const unsigned table_size) : h(smoothing_length),
+                                                                                 h2(smoothing_length * smoothing_length)
+{
+    const float pi = std::numbers::pi_v<float>;
+    const float h5 = h2 * h2 * h;
+    poly6_coef = 4.0f / (pi * h2 * h2 * h2 * h2);
+
+    const unsigned nb_samples = std::max(table_size, 2u);
+    scale = static_cast<float>(nb_samples - 1) / h2;
+
+    spiky_table.resize(nb_samples);
+    viscosity_table.resize(nb_samples);
+    for (unsigned k = 0; k < nb_samples; ++k)
+    {
+        const float r = std::sqrt(static_cast<float>(k) / scale);
+
+        // Spiky, W(r) = 10 / (pi h^5) (h - r)^3, its gradient points along d with dW/dr / r
+        // dW/dr / r diverges at r = 0, the first sample takes the value of the second
+        const float r_spiky = k == 0 ? std::sqrt(1.0f / scale) : r;
+        spiky_table[k] = -30.0f / (pi * h5) * (h - r_spiky) * (h - r_spiky) / r_spiky;
+
+        // Viscosity, laplacian is 40 / (pi h^5) (h - r)
+        viscosity_table[k] = 40.0f / (pi * h5) * (h - r);
+    }
+}
+
+// Smoothing length
+float SphKernels::get_smoothing_length() const
+{
+    return h;
+}